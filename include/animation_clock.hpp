@@ -0,0 +1,159 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <atomic>
+// when anything on screen next needs a frame. Each animated control adds
+// itself as a client and schedules its next tick, in ms on the tick clock,
+// or goes idle. The loop only renders when a tick is due, and otherwise
+// sleeps until the earliest one or until an input event wakes it, so a
+// screen with nothing moving costs no CPU and no SPI.
+class animation_clock {
+   public:
+    constexpr static const size_t max_clients = 8;
+    constexpr static const int no_client = -1;
+   private:
+    uint32_t m_due_ms[max_clients];
+    bool m_scheduled[max_clients];
+    size_t m_clients;
+    SemaphoreHandle_t m_wake;
+    std::atomic<uint32_t> m_wakes;  // input events since the last sleep
+    // since the last reset_counters()
+    uint32_t m_idle;
+    uint32_t m_sleeps;
+    uint32_t m_slept_ms;
+   public:
+    // the tick clock every due time is on
+    static uint32_t now_ms() {
+        return pdTICKS_TO_MS(xTaskGetTickCount());
+    }
+    animation_clock() : m_clients(0), m_wake(nullptr), m_wakes(0) {
+        reset_counters();
+    }
+    animation_clock(const animation_clock& rhs) = delete;
+    animation_clock& operator=(const animation_clock& rhs) = delete;
+    ~animation_clock() {
+        if (m_wake != nullptr) {
+            vSemaphoreDelete(m_wake);
+        }
+    }
+    // registers a client, due straight away. Returns its id, or no_client
+    // if there's no room.
+    int add() {
+        if (m_clients == max_clients) {
+            return no_client;
+        }
+        if (m_wake == nullptr) {
+            m_wake = xSemaphoreCreateBinary();
+        }
+        const int result = (int)m_clients++;
+        schedule(result, now_ms());
+        return result;
+    }
+    // client wants a frame once the tick clock reaches due_ms
+    void schedule(int client, uint32_t due_ms) {
+        if (client < 0 || (size_t)client >= m_clients) {
+            return;
+        }
+        m_due_ms[client] = due_ms;
+        m_scheduled[client] = true;
+    }
+    // the same, in_ms from now, for clients timing themselves on another clock
+    void schedule_in(int client, int32_t in_ms) {
+        schedule(client, now_ms() + (uint32_t)(in_ms < 0 ? 0 : in_ms));
+    }
+    // client needs no frames until it schedules one again
+    void idle(int client) {
+        if (client < 0 || (size_t)client >= m_clients) {
+            return;
+        }
+        m_scheduled[client] = false;
+    }
+    // gets the earliest scheduled tick into out_ms. Returns false if every
+    // client is idle.
+    bool next(uint32_t* out_ms) const {
+        bool result = false;
+        for (size_t i = 0; i < m_clients; ++i) {
+            if (m_scheduled[i] && (!result || (int32_t)(m_due_ms[i] - *out_ms) < 0)) {
+                *out_ms = m_due_ms[i];
+                result = true;
+            }
+        }
+        return result;
+    }
+    // true if some client's tick comes within within_ms from now
+    bool due(uint32_t within_ms = 0) const {
+        uint32_t next_ms = 0;
+        return next(&next_ms) && (int32_t)(next_ms - now_ms()) <= (int32_t)within_ms;
+    }
+    // counts a loop that found nothing due
+    void note_idle() {
+        ++m_idle;
+    }
+    // blocks until the next tick is due, an input event arrives, or
+    // max_ms goes by, whichever is first
+    void sleep(uint32_t max_ms) {
+        if (m_wake == nullptr) {
+            return;
+        }
+        uint32_t wait_ms = max_ms;
+        uint32_t next_ms = 0;
+        if (next(&next_ms)) {
+            const int32_t until = (int32_t)(next_ms - now_ms());
+            if (until <= 0) {
+                return;
+            }
+            if ((uint32_t)until < wait_ms) {
+                wait_ms = (uint32_t)until;
+            }
+        }
+        // drop a wake left over from while we weren't asleep. One that
+        // lands after this still ends the sleep below.
+        xSemaphoreTake(m_wake, 0);
+        if (m_wakes.exchange(0) != 0 || wait_ms == 0) {
+            return;
+        }
+        const uint32_t start_ms = now_ms();
+        xSemaphoreTake(m_wake, pdMS_TO_TICKS(wait_ms));
+        ++m_sleeps;
+        m_slept_ms += now_ms() - start_ms;
+    }
+    // ends a sleep early, for input events. Call from any task.
+    void wake() {
+        ++m_wakes;
+        if (m_wake != nullptr) {
+            xSemaphoreGive(m_wake);
+        }
+    }
+    // the same, from an ISR
+    void wake_from_isr(BaseType_t* higher_priority_task_woken) {
+        ++m_wakes;
+        if (m_wake != nullptr) {
+            xSemaphoreGiveFromISR(m_wake, higher_priority_task_woken);
+        }
+    }
+    // loops that found nothing due, sleeps, and the ms spent in them,
+    // since the last reset
+    uint32_t idle_loops() const {
+        return m_idle;
+    }
+    uint32_t sleeps() const {
+        return m_sleeps;
+    }
+    uint32_t slept_ms() const {
+        return m_slept_ms;
+    }
+    void reset_counters() {
+        m_idle = 0;
+        m_sleeps = 0;
+        m_slept_ms = 0;
+    }
+    // one line summing up the idle time since the last reset
+    void print() const {
+        printf("clock: %u idle loops, %u sleeps, %ums asleep\n", (unsigned)m_idle, (unsigned)m_sleeps,
+               (unsigned)m_slept_ms);
+    }
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <esp_timer.h>
+#include <atomic>
+// timestamps of each startup phase, in microseconds since boot, so
+// time-to-first-frame can be tracked from build to build. Each phase
+// keeps the first time it's marked. Phases can finish on either core.
+class boot_times {
+   public:
+    enum phase {
+        app_start = 0,  // app_main (or setup) entered
+        power,          // AXP192 initialized
+        panel,          // SPI bus and ILI9342 initialized
+        source,         // background decoded (or mapped) into place
+        allocate,       // the box allocated on its first paint
+        first_frame,    // the first frame handed to the panel
+        phase_count
+    };
+   private:
+    std::atomic<uint32_t> m_phases[phase_count];
+   public:
+    boot_times() {
+        reset();
+    }
+    static const char* phase_name(phase value) {
+        static const char* names[phase_count] = {"app_start", "power", "panel", "source", "allocate", "first_frame"};
+        return names[value];
+    }
+    void reset() {
+        for (size_t i = 0; i < phase_count; ++i) {
+            m_phases[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    // records now as the end of value, unless it was already marked
+    void mark(phase value) {
+        uint32_t expected = 0;
+        const uint32_t now = (uint32_t)esp_timer_get_time();
+        m_phases[value].compare_exchange_strong(expected, now == 0 ? 1 : now, std::memory_order_relaxed);
+    }
+    bool marked(phase value) const {
+        return 0 != m_phases[value].load(std::memory_order_relaxed);
+    }
+    // when value ended, or 0 if it hasn't yet
+    uint32_t operator[](phase value) const {
+        return m_phases[value].load(std::memory_order_relaxed);
+    }
+    uint32_t time_to_first_frame_us() const {
+        return (*this)[first_frame];
+    }
+    // one line per phase that was marked
+    void print() const {
+        printf("%-12s %9s\n", "boot(us)", "at");
+        for (size_t i = 0; i < phase_count; ++i) {
+            if (!marked((phase)i)) {
+                continue;
+            }
+            printf("%-12s %9u\n", phase_name((phase)i), (unsigned)(*this)[(phase)i]);
+        }
+        if (marked(first_frame)) {
+            printf("time to first frame: %.1fms\n", time_to_first_frame_us() / 1000.0);
+        }
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <gfx.hpp>
+// merges dirty rects into the fewest, largest panel windows that are
+// still worth it. Every window costs a fixed overhead on top of its
+// pixels (CASET, RASET and RAMWR plus the SPI transaction setup), so two
+// rects are merged whenever their bounding rect is cheaper to send than
+// both of them apart, counting the pixels the merge adds and any overlap
+// the separate rects would have sent twice.
+template<size_t Capacity>
+class flush_planner {
+    gfx::srect16 m_rects[Capacity];
+    size_t m_size;
+    size_t m_window_cost;
+    static gfx::srect16 merge(const gfx::srect16& lhs, const gfx::srect16& rhs) {
+        return gfx::srect16(lhs.x1<rhs.x1?lhs.x1:rhs.x1,
+                            lhs.y1<rhs.y1?lhs.y1:rhs.y1,
+                            lhs.x2>rhs.x2?lhs.x2:rhs.x2,
+                            lhs.y2>rhs.y2?lhs.y2:rhs.y2);
+    }
+   public:
+    // the 11 command and parameter bytes, plus the bus sitting idle for
+    // the polled transactions that carry them. esp_lcd sends CASET and
+    // RASET as a command and a parameter transaction each, then RAMWR,
+    // and each polled transaction is about 10us: 50us is about 250 bytes
+    // at 40MHz.
+    constexpr static const size_t default_window_cost = 11+250;
+    constexpr static const size_t capacity = Capacity;
+    flush_planner(size_t window_cost = default_window_cost) : m_size(0), m_window_cost(window_cost) {
+    }
+    size_t window_cost() const {
+        return m_window_cost;
+    }
+    void window_cost(size_t value) {
+        m_window_cost = value;
+    }
+    // bytes on the wire to send rect as one window
+    size_t cost(const gfx::srect16& rect) const {
+        return (size_t)rect.width()*rect.height()*2+m_window_cost;
+    }
+    void clear() {
+        m_size = 0;
+    }
+    // adds a rect (normalized). If the planner is full it merges into the
+    // last rect instead, which is never wrong, only more pixels.
+    void add(const gfx::srect16& rect) {
+        const gfx::srect16 r = rect.normalize();
+        if(m_size==Capacity) {
+            m_rects[m_size-1] = merge(m_rects[m_size-1],r);
+            return;
+        }
+        m_rects[m_size++] = r;
+    }
+    // greedily merges the pair that saves the most until no merge saves
+    // anything. Ties merge, since fewer windows also means fewer waits.
+    void plan() {
+        while(m_size>1) {
+            size_t best_i = 0, best_j = 0;
+            long long best_saving = -1;
+            for(size_t i = 0;i<m_size;++i) {
+                for(size_t j = i+1;j<m_size;++j) {
+                    const long long saving = (long long)cost(m_rects[i])+(long long)cost(m_rects[j])-(long long)cost(merge(m_rects[i],m_rects[j]));
+                    if(saving>best_saving) {
+                        best_saving = saving;
+                        best_i = i;
+                        best_j = j;
+                    }
+                }
+            }
+            if(best_saving<0) {
+                break;
+            }
+            m_rects[best_i] = merge(m_rects[best_i],m_rects[best_j]);
+            m_rects[best_j] = m_rects[--m_size];
+        }
+    }
+    size_t size() const {
+        return m_size;
+    }
+    const gfx::srect16& operator[](size_t index) const {
+        return m_rects[index];
+    }
+    // bytes on the wire to send every planned rect
+    size_t total_cost() const {
+        size_t result = 0;
+        for(size_t i = 0;i<m_size;++i) {
+            result+=cost(m_rects[i]);
+        }
+        return result;
+    }
+};
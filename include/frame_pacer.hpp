@@ -0,0 +1,246 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#if defined(WARHOL_SIM)
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#endif
+#include "frame_stats.hpp"
+// starts frames on a fixed grid of deadlines at a target rate. wait()
+// sleeps until the next deadline, on a one-shot esp_timer (or
+// clock_nanosleep on the host) rather than the 1ms tick, so the idle task
+// gets the rest of every frame. A frame that overruns its slot doesn't
+// make the next ones run back to back to catch up: the deadlines it
+// missed are skipped, and the next frame starts right away on the grid.
+// With a target of 0 frames run unpaced, yielding a tick now and then so
+// the idle task can still feed the watchdog.
+class frame_pacer {
+   public:
+    constexpr static const uint32_t default_fps = 30;
+   private:
+    uint32_t m_period_us;
+    bool m_started;
+    uint32_t m_next_us;        // the deadline of the next frame
+    uint64_t m_deadlines;      // deadlines from the first frame to the next one
+    uint32_t m_origin_ms;      // when the first frame started, on the tick clock
+    uint32_t m_last_start_us;  // when the last frame started
+    uint32_t m_yield_us;       // unpaced: when the loop last yielded
+    // since the last reset_counters()
+    uint32_t m_frames;
+    uint32_t m_overruns;
+    uint32_t m_skipped;
+    frame_stats* m_stats;
+    // waits up to this long spin instead of sleeping. Anything longer
+    // sleeps, and a wake a little early or late is left to the jitter.
+    constexpr static const uint32_t max_spin_us = 5;
+    constexpr static const uint32_t unpaced_yield_us = 150 * 1000;
+#if !defined(WARHOL_SIM)
+    esp_timer_handle_t m_timer;
+    TaskHandle_t m_waiter;
+    static void on_timer(void* arg) {
+        xTaskNotifyGive(((frame_pacer*)arg)->m_waiter);
+    }
+#endif
+    static uint32_t now_us() {
+        return frame_stats::now_us();
+    }
+    // the clock millis() and animation_clock run on
+    static uint32_t now_ms() {
+        return pdTICKS_TO_MS(xTaskGetTickCount());
+    }
+    void sleep_until(uint32_t deadline_us) {
+        const int32_t delay_us = (int32_t)(deadline_us - now_us());
+        if (delay_us <= 0) {
+            return;
+        }
+        if (delay_us > (int32_t)max_spin_us) {
+#if defined(WARHOL_SIM)
+            timespec at;
+            clock_gettime(CLOCK_MONOTONIC, &at);
+            at.tv_nsec += (long)delay_us * 1000;
+            at.tv_sec += at.tv_nsec / 1000000000;
+            at.tv_nsec %= 1000000000;
+            while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, nullptr)) {
+            }
+#else
+            if (m_timer == nullptr) {
+                esp_timer_create_args_t args = {};
+                args.callback = on_timer;
+                args.arg = this;
+                args.dispatch_method = ESP_TIMER_TASK;
+                args.name = "frame_pacer";
+                if (ESP_OK != esp_timer_create(&args, &m_timer)) {
+                    m_timer = nullptr;
+                }
+            }
+            if (m_timer != nullptr) {
+                m_waiter = xTaskGetCurrentTaskHandle();
+                ulTaskNotifyTake(pdTRUE, 0);
+                if (ESP_OK == esp_timer_start_once(m_timer, (uint64_t)delay_us)) {
+                    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                }
+            } else {
+                vTaskDelay(pdMS_TO_TICKS(delay_us / 1000));
+            }
+#endif
+        }
+        // a few us left, or an early wake by that much
+        const int32_t left_us = (int32_t)(deadline_us - now_us());
+        if (left_us > 0 && left_us <= (int32_t)max_spin_us) {
+            while ((int32_t)(deadline_us - now_us()) > 0) {
+            }
+        }
+    }
+    void record(uint32_t start_us, uint32_t late_us) {
+        if (m_stats != nullptr) {
+            if (m_last_start_us != 0) {
+                m_stats->add_elapsed(frame_stats::interval, start_us - m_last_start_us);
+            }
+            if (m_period_us != 0) {
+                m_stats->add_elapsed(frame_stats::jitter, late_us);
+            }
+        }
+        m_last_start_us = start_us;
+        ++m_frames;
+    }
+   public:
+    frame_pacer()
+        : m_period_us(1000000 / default_fps), m_started(false), m_next_us(0), m_deadlines(0), m_origin_ms(0), m_last_start_us(0), m_yield_us(0),
+          m_stats(nullptr)
+#if !defined(WARHOL_SIM)
+          ,
+          m_timer(nullptr),
+          m_waiter(nullptr)
+#endif
+    {
+        reset_counters();
+    }
+    frame_pacer(const frame_pacer& rhs) = delete;
+    frame_pacer& operator=(const frame_pacer& rhs) = delete;
+    ~frame_pacer() {
+#if !defined(WARHOL_SIM)
+        if (m_timer != nullptr) {
+            esp_timer_stop(m_timer);
+            esp_timer_delete(m_timer);
+        }
+#endif
+    }
+    // frames per second to aim for, or 0 to run unpaced
+    uint32_t target_fps() const {
+        return m_period_us == 0 ? 0 : 1000000 / m_period_us;
+    }
+    void target_fps(uint32_t value) {
+        m_period_us = value == 0 ? 0 : 1000000 / value;
+        m_started = false;
+    }
+    bool paced() const {
+        return m_period_us != 0;
+    }
+    uint32_t period_us() const {
+        return m_period_us;
+    }
+    // records each frame's start interval and how late it woke into
+    // stats, or nothing if it's null
+    frame_stats* stats() const {
+        return m_stats;
+    }
+    void stats(frame_stats* value) {
+        m_stats = value;
+    }
+    // starts a new grid from the next frame, for when the loop slept
+    // through some on purpose, so they don't count as overruns
+    void resync() {
+        m_started = false;
+        m_last_start_us = 0;
+    }
+    // blocks until the next frame is due. Call once per frame, before it.
+    void wait() {
+        if (m_period_us == 0) {
+            const uint32_t now = now_us();
+            if (now - m_yield_us >= unpaced_yield_us) {
+                m_yield_us = now;
+#if defined(WARHOL_SIM)
+                sched_yield();
+#else
+                vTaskDelay(1);
+#endif
+            }
+            record(now_us(), 0);
+            return;
+        }
+        uint32_t now = now_us();
+        if (!m_started) {
+            m_started = true;
+            m_next_us = now;
+            m_deadlines = 0;
+            m_origin_ms = now_ms();
+        }
+        uint32_t late_us = 0;
+        if ((int32_t)(m_next_us - now) > 0) {
+            sleep_until(m_next_us);
+            now = now_us();
+            late_us = now - m_next_us;
+        } else {
+            late_us = now - m_next_us;
+            if (late_us >= m_period_us) {
+                // the last frame overran: drop the deadlines it missed
+                const uint32_t missed = late_us / m_period_us;
+                m_next_us += missed * m_period_us;
+                m_deadlines += missed;
+                late_us -= missed * m_period_us;
+                ++m_overruns;
+                m_skipped += missed;
+            }
+        }
+        record(now, late_us);
+        m_next_us += m_period_us;
+        ++m_deadlines;
+    }
+    // when the frame after the one wait() just started is due, on the
+    // esp_timer clock
+    uint32_t next_deadline_us() const {
+        return m_next_us;
+    }
+    // the same, as time since the first paced frame started. It only
+    // ever moves in whole periods, skipped ones included, so animating to
+    // it steps the same amount every frame however late each one woke.
+    uint64_t next_offset_us() const {
+        return m_deadlines * m_period_us;
+    }
+    // the same on the tick clock millis() runs on, anchored when the
+    // first paced frame started, for an animation to step to
+    uint32_t frame_time_ms() const {
+        return m_origin_ms + (uint32_t)(next_offset_us() / 1000);
+    }
+    // frames started since the last reset
+    uint32_t frames() const {
+        return m_frames;
+    }
+    // frames that started a whole period or more late, and the deadlines
+    // they skipped
+    uint32_t overruns() const {
+        return m_overruns;
+    }
+    uint32_t skipped() const {
+        return m_skipped;
+    }
+    void reset_counters() {
+        m_frames = 0;
+        m_overruns = 0;
+        m_skipped = 0;
+    }
+    // one line summing up the frames since the last reset
+    void print() const {
+        if (m_period_us == 0) {
+            printf("pacer: unpaced, %u frames\n", (unsigned)m_frames);
+            return;
+        }
+        printf("pacer: %u FPS target, %u frames, %u overruns, %u deadlines skipped\n", (unsigned)target_fps(),
+               (unsigned)m_frames, (unsigned)m_overruns, (unsigned)m_skipped);
+    }
+};
@@ -0,0 +1,139 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <esp_timer.h>
+#include <atomic>
+// microsecond timing histograms for each stage of a frame. Samples can
+// come from either core and from the flush-done ISR, so every counter is
+// a relaxed atomic and adding one never blocks.
+
+// log-linear histogram: exact below 16us, then 8 buckets per power of
+// two, so any percentile is within 12.5% of the real value
+class stage_histogram {
+    constexpr static const uint32_t linear = 16;
+    constexpr static const uint32_t octave_buckets = 8;
+    constexpr static const uint32_t octaves = 16; // 16us to ~1s
+    constexpr static const size_t bucket_count = linear + octaves * octave_buckets;
+    std::atomic<uint32_t> m_buckets[bucket_count];
+    std::atomic<uint32_t> m_count;
+    std::atomic<uint32_t> m_max;
+    static size_t bucket(uint32_t us) {
+        if (us < linear) {
+            return us;
+        }
+        const uint32_t octave = 31 - __builtin_clz(us);  // 4 and up
+        const size_t result = linear + (octave - 4) * octave_buckets + ((us >> (octave - 3)) & (octave_buckets - 1));
+        return result < bucket_count ? result : bucket_count - 1;
+    }
+    // the largest value that lands in a bucket
+    static uint32_t bucket_top(size_t index) {
+        if (index < linear) {
+            return (uint32_t)index;
+        }
+        const uint32_t octave = (uint32_t)(index - linear) / octave_buckets + 4;
+        const uint32_t sub = (uint32_t)(index - linear) % octave_buckets;
+        return (1U << octave) + ((sub + 1) << (octave - 3)) - 1;
+    }
+   public:
+    stage_histogram() {
+        reset();
+    }
+    void reset() {
+        for (size_t i = 0; i < bucket_count; ++i) {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+    void add(uint32_t us) {
+        m_buckets[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        uint32_t max = m_max.load(std::memory_order_relaxed);
+        while (us > max && !m_max.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+        }
+    }
+    uint32_t count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+    uint32_t max() const {
+        return m_max.load(std::memory_order_relaxed);
+    }
+    // the value per_mille/1000 of the samples are at or below
+    uint32_t percentile(uint32_t per_mille) const {
+        const uint32_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        const uint32_t rank = (uint32_t)(((uint64_t)total * per_mille + 999) / 1000);
+        uint32_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                const uint32_t top = bucket_top(i);
+                return top < max() ? top : max();
+            }
+        }
+        return max();
+    }
+};
+
+class frame_stats {
+   public:
+    enum stage {
+        before_paint = 0,  // warhol_box::on_before_paint
+        bg_compose,        // one background tinted by bg_task
+        paint,             // one stripe composed by on_paint or render()
+        flush,             // one transfer, from queuing it to the DMA done ISR
+        flush_wait,        // blocked waiting for a free transfer buffer
+        after_paint,       // warhol_box::on_after_paint
+        physics,           // moving and colliding the bars, part of after_paint
+        frame,             // a whole loop() iteration
+        latency,           // direct mode: a frame's snapshot to its last pixel on the panel
+        interval,          // from one frame's start to the next
+        jitter,            // paced: how late a frame started after its deadline
+        stage_count
+    };
+   private:
+    stage_histogram m_stages[stage_count];
+   public:
+    static uint32_t now_us() {
+        return (uint32_t)esp_timer_get_time();
+    }
+    static const char* stage_name(stage value) {
+        static const char* names[stage_count] = {"before_paint", "bg_compose", "paint", "flush", "flush_wait", "after_paint", "physics", "frame", "latency", "interval", "jitter"};
+        return names[value];
+    }
+    const stage_histogram& operator[](stage value) const {
+        return m_stages[value];
+    }
+    // records a stage that started at start_us (from now_us())
+    void add(stage value, uint32_t start_us) {
+        m_stages[value].add(now_us() - start_us);
+    }
+    void add_elapsed(stage value, uint32_t us) {
+        m_stages[value].add(us);
+    }
+    void reset() {
+        for (size_t i = 0; i < stage_count; ++i) {
+            m_stages[i].reset();
+        }
+    }
+    // one line per stage that saw samples
+    void print() const {
+        printf("%-12s %6s %7s %7s %7s %7s\n", "stage(us)", "count", "p50", "p95", "p99", "max");
+        for (size_t i = 0; i < stage_count; ++i) {
+            const stage_histogram& h = m_stages[i];
+            if (h.count() == 0) {
+                continue;
+            }
+            printf("%-12s %6u %7u %7u %7u %7u\n",
+                   stage_name((stage)i),
+                   (unsigned)h.count(),
+                   (unsigned)h.percentile(500),
+                   (unsigned)h.percentile(950),
+                   (unsigned)h.percentile(990),
+                   (unsigned)h.max());
+        }
+    }
+};
@@ -2,13 +2,104 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "ui.hpp"
-// use two uffers (DMA)
-constexpr const size_t panel_transfer_buffer_size = 320*60*2;
-extern uint8_t* panel_transfer_buffer1;
-extern uint8_t* panel_transfer_buffer2;
+#include "frame_stats.hpp"
+#include "trace.hpp"
+#include "boot_times.hpp"
+#include "stripe_scheduler.hpp"
+#include "frame_pacer.hpp"
+#include "animation_clock.hpp"
+#include "quality_governor.hpp"
+// a ring of DMA transfer buffers, each a stripe of full width lines.
+// panel_init() picks how many and how tall from the free DMA heap. UIX
+// double buffers through the first two; the direct renderer uses them
+// all, so it can run further ahead of the SPI transfers.
+constexpr const size_t panel_max_transfer_buffers = 8;
+// what panel_init() aims for when nothing is requested
+constexpr const size_t panel_default_transfer_buffers = 4;
+constexpr const size_t panel_default_stripe_lines = 60;
+// stripes are never shorter than this
+constexpr const size_t panel_min_stripe_lines = 8;
+// DMA capable heap left for everything else
+constexpr const size_t panel_dma_reserve = 32*1024;
+// requested buffer count and stripe height, 0 for the defaults. These
+// are limits: panel_init() uses fewer or shorter if they don't fit. They
+// default to WARHOL_TRANSFER_BUFFERS and WARHOL_STRIPE_LINES when those
+// are defined. Set before app_main().
+extern size_t panel_transfer_buffers_requested;
+extern size_t panel_stripe_lines_requested;
+// what panel_init() allocated
+extern size_t panel_transfer_buffer_count;
+extern size_t panel_transfer_buffer_size;
+extern uint8_t* panel_transfer_buffers[panel_max_transfer_buffers];
+// render straight into the transfer buffers instead of going through UIX.
+// Defaults to on when WARHOL_DIRECT is defined. Set before app_main().
+extern bool panel_direct;
+// the direct renderer splits each frame's stripes between this many
+// workers: the loop task, plus render tasks on the other core (or more
+// threads in the simulator). Defaults to 2, or WARHOL_RENDER_WORKERS when
+// that's defined. Set before app_main().
+constexpr const size_t panel_max_render_workers = 4;
+extern size_t panel_render_workers;
+extern stripe_scheduler<panel_max_render_workers> panel_scheduler;
+// direct mode frames allowed in flight at once, from when their state is
+// captured to when their last pixel is on the panel. 1 is low latency: a
+// frame is only captured once the last one is fully on screen. 2 (the
+// default) or more is throughput: the next frame is updated and composed
+// while the last one is still going out over SPI, at the cost of up to
+// that many frames of lag. Defaults to WARHOL_PIPELINE_DEPTH when that's
+// defined. Set before app_main().
+constexpr const size_t panel_max_pipeline_depth = 4;
+extern size_t panel_pipeline_depth;
+// stage timings, printed and reset by loop() about once a second
+extern frame_stats panel_stats;
+// recent render and flush events, dumped as Chrome trace JSON
+extern trace_buffer panel_trace;
+// when each startup phase finished, printed after the first frame
+extern boot_times panel_boot;
+// decode the background on the other core during panel_init(). Defaults
+// to on unless WARHOL_NO_PRELOAD is defined. Set before app_main().
+extern bool panel_preload;
+// bars bounce off each other as well as the edges, spending at most
+// panel_physics_budget_us a frame on it. Default to WARHOL_COLLISIONS and
+// WARHOL_PHYSICS_BUDGET_US. Set before app_main().
+extern bool panel_collisions;
+extern uint32_t panel_physics_budget_us;
 
-void panel_init();
-
-void panel_update();
+// loop() starts a frame every 1/panel_target_fps seconds, sleeping in
+// between, and skips the deadlines of frames that overrun. 0 runs it
+// unpaced. Defaults to 30, or WARHOL_TARGET_FPS when that's defined. Set
+// before app_main().
+extern uint32_t panel_target_fps;
+extern frame_pacer panel_pacer;
+// controls schedule their next tick on panel_clock, and loop() skips
+// rendering until one is due, sleeping in between when panel_idle_sleep
+// is set (the default). 'p' on the console pauses the animation, 'h'
+// switches direct mode between full and half resolution, and 'i' between
+// progressive and interlaced.
+extern animation_clock panel_clock;
+extern bool panel_idle_sleep;
+// true if a control needs a frame by the time the next one would start
+bool panel_frame_due();
+// steps the box's quality down when the average frame cost runs over
+// panel_frame_budget_us, or one pacer period when that's 0, and back up
+// when there's room again. On unless WARHOL_NO_GOVERNOR is defined. The
+// budget defaults to WARHOL_FRAME_BUDGET_US. Set before app_main().
+extern bool panel_governor_enabled;
+extern uint32_t panel_frame_budget_us;
+extern quality_governor panel_governor;
+// direct mode frames alternate between sending only the even and only the
+// odd rows of what changed, each row its own window, for half the SPI
+// traffic per frame. A moving edge then takes two frames to fully land.
+// Only frames whose field costs less on the wire than the whole frame,
+// each row's window included, go out as fields. Defaults to on when
+// WARHOL_INTERLACE is defined.
+extern bool panel_interlace;
+// frames sent as a single field since boot
+extern uint32_t panel_field_frames;
 
-void panel_set_active_screen(screen_t& new_screen);
\ No newline at end of file
+void panel_init();
+#ifdef WARHOL_SIM
+// blocks until every transfer queued so far is on the panel, in direct
+// mode or through UIX. The simulator calls it between runs.
+void panel_flush_wait();
+#endif
\ No newline at end of file
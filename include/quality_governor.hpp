@@ -0,0 +1,174 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+// what gets cheaper at each quality level. The first knobs cost the least
+// to look at, so they go first: bar color precision, then how often the
+// background tint moves on (each move repaints the whole screen), then
+// how many bars there are, then the resolution everything's composed at.
+struct quality_level {
+    uint8_t sprite_percent;  // of the bars allocated, drawn and moved
+    uint8_t blend_bits;      // of the 8 bit bar color blend
+    uint8_t bg_stride;       // background tint steps per repaint, a power of two
+    uint8_t render_scale;    // 2 composes at half resolution
+};
+
+// steps through quality levels to keep the measured frame cost within a
+// budget. add() takes each frame's cost and keeps a running average. It
+// drops a level once that average has been over the budget for a few
+// frames in a row. It only climbs back once the average has been well
+// under budget for up_frames in a row, a couple of seconds at 30 FPS.
+// Each level change then holds for a while, and climbing into a level
+// that has to be dropped again soon after doubles the wait before the
+// next climb, so a load sitting right at the edge doesn't make the levels
+// flap.
+class quality_governor {
+   public:
+    constexpr static const size_t level_count = 6;
+    // frames over budget before dropping a level, and under up_percent of
+    // it before climbing one
+    constexpr static const uint32_t down_frames = 4;
+    constexpr static const uint32_t up_frames = 60;
+    constexpr static const uint32_t up_percent = 60;
+    // frames a new level holds before the next change
+    constexpr static const uint32_t settle_frames = 15;
+    // the most the climb wait backs off to, in multiples of up_frames
+    constexpr static const uint32_t max_backoff = 8;
+    static const quality_level& level_at(size_t index) {
+        static const quality_level levels[level_count] = {
+            {100, 8, 1, 1},
+            {100, 4, 2, 1},
+            {75, 4, 4, 1},
+            {50, 2, 4, 1},
+            {50, 2, 4, 2},
+            {25, 2, 8, 2},
+        };
+        return levels[index < level_count ? index : level_count - 1];
+    }
+   private:
+    uint32_t m_budget_us;
+    size_t m_level;
+    uint32_t m_average_us;  // running average of the frame cost, x8
+    bool m_primed;
+    uint32_t m_over;   // frames in a row over budget
+    uint32_t m_under;  // frames in a row well under it
+    uint32_t m_hold;   // frames before the level can change again
+    uint32_t m_since_climb;
+    uint32_t m_backoff[level_count];  // climb wait into each level, in up_frames
+    uint32_t m_level_us[level_count];  // average frame cost last seen at each level
+    uint32_t m_changes;                // since the last reset_counters()
+   public:
+    quality_governor() : m_budget_us(0) {
+        reset();
+    }
+    // the frame cost to stay within, or 0 to stay at full quality
+    uint32_t budget_us() const {
+        return m_budget_us;
+    }
+    void budget_us(uint32_t value) {
+        m_budget_us = value;
+        if (value == 0) {
+            reset();
+        }
+    }
+    // back to full quality, forgetting everything measured
+    void reset() {
+        m_level = 0;
+        m_average_us = 0;
+        m_primed = false;
+        m_over = 0;
+        m_under = 0;
+        m_hold = 0;
+        m_since_climb = 0xFFFFFFFF;
+        for (size_t i = 0; i < level_count; ++i) {
+            m_backoff[i] = 1;
+            m_level_us[i] = 0;
+        }
+        m_changes = 0;
+    }
+    // the level in force, 0 being full quality, and what it turns down
+    size_t level() const {
+        return m_level;
+    }
+    const quality_level& current() const {
+        return level_at(m_level);
+    }
+    // the running average frame cost
+    uint32_t average_us() const {
+        return m_average_us / 8;
+    }
+    // the average frame cost last measured at a level, or 0 if it hasn't
+    // run at it. Comparing neighbors shows what each level saves.
+    uint32_t level_us(size_t index) const {
+        return index < level_count ? m_level_us[index] : 0;
+    }
+    // level changes since the last reset
+    uint32_t changes() const {
+        return m_changes;
+    }
+    void reset_counters() {
+        m_changes = 0;
+    }
+    // takes the cost of the frame just finished. Returns true if the level
+    // changed, in which case apply current() before the next frame.
+    bool add(uint32_t cost_us) {
+        if (!m_primed) {
+            m_average_us = cost_us * 8;
+            m_primed = true;
+        } else {
+            // 1/8 of the way to each new frame
+            m_average_us = m_average_us - m_average_us / 8 + cost_us;
+        }
+        const uint32_t average = m_average_us / 8;
+        m_level_us[m_level] = average;
+        if (m_since_climb != 0xFFFFFFFF) {
+            ++m_since_climb;
+        }
+        if (m_budget_us == 0) {
+            return false;
+        }
+        if (m_hold != 0) {
+            --m_hold;
+            return false;
+        }
+        m_over = average > m_budget_us ? m_over + 1 : 0;
+        m_under = (uint64_t)average * 100 < (uint64_t)m_budget_us * up_percent ? m_under + 1 : 0;
+        if (m_over >= down_frames && m_level + 1 < level_count) {
+            // climbed in here not long ago and it didn't hold: wait
+            // longer before trying it again
+            if (m_since_climb < up_frames * 2 && m_backoff[m_level] < max_backoff) {
+                m_backoff[m_level] *= 2;
+            }
+            m_since_climb = 0xFFFFFFFF;
+            change(m_level + 1);
+            return true;
+        }
+        if (m_level != 0 && m_under >= up_frames * m_backoff[m_level - 1]) {
+            m_since_climb = 0;
+            change(m_level - 1);
+            return true;
+        }
+        return false;
+    }
+    // one line with the level and the cost of each level measured so far
+    void print() const {
+        const quality_level& q = current();
+        printf("quality: level %u of %u (%u%% bars, %u bit blends, tint every %u steps, 1/%u scale), %uus/frame of %uus,",
+               (unsigned)m_level, (unsigned)(level_count - 1), (unsigned)q.sprite_percent, (unsigned)q.blend_bits,
+               (unsigned)q.bg_stride, (unsigned)q.render_scale, (unsigned)average_us(), (unsigned)m_budget_us);
+        for (size_t i = 0; i < level_count; ++i) {
+            if (m_level_us[i] != 0) {
+                printf(" L%u %uus", (unsigned)i, (unsigned)m_level_us[i]);
+            }
+        }
+        printf(", %u changes\n", (unsigned)m_changes);
+    }
+   private:
+    void change(size_t level) {
+        m_level = level;
+        m_over = 0;
+        m_under = 0;
+        m_hold = settle_frames;
+        ++m_changes;
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+// RGB565 kernels over buffers in panel byte order (big-endian), which is
+// how gfx bitmaps store rgb_pixel<16>. Blends are done in integer math,
+// two pixels per 32-bit word, with each channel in its own 16-bit lane.
+
+// a constant color premultiplied by its alpha, ready to blend
+struct rgb565_tint {
+    uint32_t r; // red*alpha in 5-bit units x256, in both lanes, plus rounding
+    uint32_t g;
+    uint32_t b;
+    uint32_t inv; // 256-alpha
+};
+inline rgb565_tint rgb565_make_tint(uint8_t r, uint8_t g, uint8_t b, uint8_t alpha) {
+    const uint32_t a = alpha + (alpha >> 7); // 0-256
+    const uint32_t tr = (r * 31 * a + 127) / 255 + 128;
+    const uint32_t tg = (g * 63 * a + 127) / 255 + 128;
+    const uint32_t tb = (b * 31 * a + 127) / 255 + 128;
+    rgb565_tint result;
+    result.r = tr | (tr << 16);
+    result.g = tg | (tg << 16);
+    result.b = tb | (tb << 16);
+    result.inv = 256 - a;
+    return result;
+}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// swaps the bytes of both 16-bit lanes
+inline uint32_t rgb565_swap2(uint32_t value) {
+    return ((value >> 8) & 0x00FF00FF) | ((value & 0x00FF00FF) << 8);
+}
+inline uint16_t rgb565_swap(uint16_t value) {
+    return (uint16_t)((value >> 8) | (value << 8));
+}
+#else
+inline uint32_t rgb565_swap2(uint32_t value) { return value; }
+inline uint16_t rgb565_swap(uint16_t value) { return value; }
+#endif
+// blends two native-order pixels, one per 16-bit lane. Every channel
+// product stays below 2^14, so the lanes can't carry into each other.
+inline uint32_t rgb565_blend2_native(uint32_t px, const rgb565_tint& tint) {
+    const uint32_t r = ((((px >> 11) & 0x001F001F) * tint.inv + tint.r) >> 8) & 0x001F001F;
+    const uint32_t g = ((((px >> 5) & 0x003F003F) * tint.inv + tint.g) >> 8) & 0x003F003F;
+    const uint32_t b = (((px & 0x001F001F) * tint.inv + tint.b) >> 8) & 0x001F001F;
+    return (r << 11) | (g << 5) | b;
+}
+// blends two pixels in panel byte order
+inline uint32_t rgb565_blend2(uint32_t px, const rgb565_tint& tint) {
+    return rgb565_swap2(rgb565_blend2_native(rgb565_swap2(px), tint));
+}
+// blends one pixel in panel byte order
+inline uint16_t rgb565_blend1(uint16_t px, const rgb565_tint& tint) {
+    return rgb565_swap((uint16_t)rgb565_blend2_native(rgb565_swap(px), tint));
+}
+// writes src blended with tint into dst in a single pass. dst may be src.
+// Both must be at least 2-byte aligned.
+inline void rgb565_blend(void* dst, const void* src, size_t pixels, const rgb565_tint& tint) {
+    uint16_t* d = (uint16_t*)dst;
+    const uint16_t* s = (const uint16_t*)src;
+    if (pixels != 0 && 0 != ((uintptr_t)d & 3)) {
+        *d++ = rgb565_blend1(*s++, tint);
+        --pixels;
+    }
+    size_t pairs = pixels >> 1;
+    if (0 == ((uintptr_t)s & 3)) {
+        uint32_t* d32 = (uint32_t*)d;
+        const uint32_t* s32 = (const uint32_t*)s;
+        while (pairs--) {
+            *d32++ = rgb565_blend2(*s32++, tint);
+        }
+        d = (uint16_t*)d32;
+        s = (const uint16_t*)s32;
+    } else {
+        // source and destination disagree on word alignment
+        while (pairs--) {
+            const uint32_t px = rgb565_blend2(s[0] | ((uint32_t)s[1] << 16), tint);
+            d[0] = (uint16_t)px;
+            d[1] = (uint16_t)(px >> 16);
+            d += 2;
+            s += 2;
+        }
+    }
+    if (pixels & 1) {
+        *d = rgb565_blend1(*s, tint);
+    }
+}
+// blends a constant color over a rect of a buffer in place. stride is the
+// distance between rows in bytes.
+inline void rgb565_fill_blend(void* dst, size_t stride, size_t width, size_t height, const rgb565_tint& tint) {
+    uint8_t* row = (uint8_t*)dst;
+    while (height--) {
+        rgb565_blend(row, row, width, tint);
+        row += stride;
+    }
+}
+// writes each of src_width pixels twice into dst
+inline void rgb565_double_row(void* dst, const void* src, size_t src_width) {
+    const uint16_t* s = (const uint16_t*)src;
+    if (0 == ((uintptr_t)dst & 3)) {
+        // the same pixel in both lanes, whatever the byte order
+        uint32_t* d32 = (uint32_t*)dst;
+        for (size_t x = 0; x < src_width; ++x) {
+            d32[x] = s[x] * 0x00010001U;
+        }
+    } else {
+        uint16_t* d = (uint16_t*)dst;
+        for (size_t x = 0; x < src_width; ++x) {
+            d[x * 2] = d[x * 2 + 1] = s[x];
+        }
+    }
+}
+// scales a block down 2x into dst, each 2x2 square of src averaged into
+// one pixel. Strides are in bytes.
+inline void rgb565_downsample2x(void* dst, size_t dst_stride, const void* src, size_t src_stride, size_t dst_width,
+                                size_t dst_height) {
+    uint8_t* drow = (uint8_t*)dst;
+    const uint8_t* srow = (const uint8_t*)src;
+    while (dst_height--) {
+        const uint16_t* s0 = (const uint16_t*)srow;
+        const uint16_t* s1 = (const uint16_t*)(srow + src_stride);
+        uint16_t* d = (uint16_t*)drow;
+        for (size_t x = 0; x < dst_width; ++x) {
+            const uint16_t px[4] = {rgb565_swap(s0[x * 2]), rgb565_swap(s0[x * 2 + 1]), rgb565_swap(s1[x * 2]),
+                                    rgb565_swap(s1[x * 2 + 1])};
+            uint32_t r = 2, g = 2, b = 2;
+            for (int i = 0; i < 4; ++i) {
+                r += px[i] >> 11;
+                g += (px[i] >> 5) & 0x3F;
+                b += px[i] & 0x1F;
+            }
+            d[x] = rgb565_swap((uint16_t)(((r >> 2) << 11) | ((g >> 2) << 5) | (b >> 2)));
+        }
+        drow += dst_stride;
+        srow += src_stride * 2;
+    }
+}
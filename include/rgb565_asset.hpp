@@ -0,0 +1,143 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+// pre-decoded RGB565 images, stored in panel byte order so they can be
+// copied (or decompressed) straight into a bitmap with no decode step.
+// An asset is a 16 byte header followed by the pixels:
+//   "R565", width, height (uint16 LE), format, payload size (uint32 LE)
+// The simulator writes them with --export-asset.
+
+enum struct rgb565_asset_format : uint32_t {
+    raw = 0,  // width*height*2 bytes
+    lz4 = 1,  // one LZ4 block that inflates to width*height*2 bytes
+};
+constexpr const size_t rgb565_asset_header_size = 16;
+constexpr const char rgb565_asset_magic[4] = {'R', '5', '6', '5'};
+
+struct rgb565_asset_info {
+    uint16_t width;
+    uint16_t height;
+    rgb565_asset_format format;
+    uint32_t payload_size;
+    const uint8_t* payload;
+};
+inline uint16_t rgb565_asset_read16(const uint8_t* src) {
+    return (uint16_t)(src[0] | (src[1] << 8));
+}
+inline uint32_t rgb565_asset_read32(const uint8_t* src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+// fills out the 16 byte header for an asset
+inline void rgb565_asset_write_header(uint8_t* dst, uint16_t width, uint16_t height, rgb565_asset_format format, uint32_t payload_size) {
+    memcpy(dst, rgb565_asset_magic, 4);
+    dst[4] = (uint8_t)width;
+    dst[5] = (uint8_t)(width >> 8);
+    dst[6] = (uint8_t)height;
+    dst[7] = (uint8_t)(height >> 8);
+    for (int i = 0; i < 4; ++i) {
+        dst[8 + i] = (uint8_t)((uint32_t)format >> (i * 8));
+        dst[12 + i] = (uint8_t)(payload_size >> (i * 8));
+    }
+}
+// validates an asset's header. Returns false if it isn't one.
+inline bool rgb565_asset_parse(const uint8_t* asset, size_t asset_size, rgb565_asset_info* out_info) {
+    if (asset == nullptr || asset_size < rgb565_asset_header_size || 0 != memcmp(asset, rgb565_asset_magic, 4)) {
+        return false;
+    }
+    rgb565_asset_info info;
+    info.width = rgb565_asset_read16(asset + 4);
+    info.height = rgb565_asset_read16(asset + 6);
+    info.format = (rgb565_asset_format)rgb565_asset_read32(asset + 8);
+    info.payload_size = rgb565_asset_read32(asset + 12);
+    info.payload = asset + rgb565_asset_header_size;
+    if (info.payload_size > asset_size - rgb565_asset_header_size) {
+        return false;
+    }
+    if (info.format == rgb565_asset_format::raw && info.payload_size != (uint32_t)info.width * info.height * 2) {
+        return false;
+    }
+    if (info.format != rgb565_asset_format::raw && info.format != rgb565_asset_format::lz4) {
+        return false;
+    }
+    *out_info = info;
+    return true;
+}
+// decompresses one LZ4 block (no frame). Returns the bytes written, or
+// -1 if the block is corrupt or doesn't fit in dst.
+inline long lz4_decompress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) {
+    const uint8_t* ip = src;
+    const uint8_t* const ip_end = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* const op_end = dst + dst_size;
+    while (ip < ip_end) {
+        const uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t extra;
+            do {
+                if (ip == ip_end) {
+                    return -1;
+                }
+                extra = *ip++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == ip_end) {
+            break;  // the last sequence has no match
+        }
+        if (ip_end - ip < 2) {
+            return -1;
+        }
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        size_t match = (token & 15) + 4;
+        if ((token & 15) == 15) {
+            uint8_t extra;
+            do {
+                if (ip == ip_end) {
+                    return -1;
+                }
+                extra = *ip++;
+                match += extra;
+            } while (extra == 255);
+        }
+        if (match > (size_t)(op_end - op)) {
+            return -1;
+        }
+        const uint8_t* from = op - offset;
+        if (offset >= match) {
+            memcpy(op, from, match);
+            op += match;
+        } else {
+            // overlapping copy repeats the last offset bytes
+            while (match--) {
+                *op++ = *from++;
+            }
+        }
+    }
+    return (long)(op - dst);
+}
+// loads an asset into dst, a width*height RGB565 buffer in panel byte
+// order. The asset must be exactly that size.
+inline bool rgb565_asset_load(const uint8_t* asset, size_t asset_size, uint8_t* dst, uint16_t width, uint16_t height) {
+    rgb565_asset_info info;
+    if (!rgb565_asset_parse(asset, asset_size, &info) || info.width != width || info.height != height) {
+        return false;
+    }
+    const size_t size = (size_t)width * height * 2;
+    if (info.format == rgb565_asset_format::raw) {
+        memcpy(dst, info.payload, size);
+        return true;
+    }
+    return (long)size == lz4_decompress_block(info.payload, info.payload_size, dst, size);
+}
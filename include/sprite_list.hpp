@@ -0,0 +1,259 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <gfx.hpp>
+#include "rgb565.hpp"
+// runtime sized sprite storage, kept as structure of arrays so the per
+// frame passes (move, tint, bin) each stream through only the fields
+// they use. Everything lives in one allocation.
+struct sprite_list {
+    int32_t* xs;                    // 24.8 centers
+    int32_t* ys;
+    int32_t* x0s;                   // 24.8 centers at the motion's origin
+    int32_t* y0s;
+    int32_t* dxs;                   // deltas, pixels per nominal frame (at the origin, for closed-form motion)
+    int32_t* dys;                   // 32 bits wide so they load into the same vector lanes as the centers
+    rgb565_tint* tints;             // current colors, premultiplied
+    gfx::rgba_pixel<32>* colors;
+    gfx::rgba_pixel<32>* colors_next;
+    gfx::srect16* dirty;            // each sprite's old rect merged with its new one
+    int16_t* cxs;                   // rounded centers
+    int16_t* cys;
+    uint16_t* blends;               // 8.8 progress from colors to colors_next
+    size_t size;                    // how many are in use, up to capacity
+    size_t capacity;
+    void* block;
+    sprite_list() : size(0), capacity(0), block(nullptr) {
+    }
+    // bytes one sprite takes, for sizing the list against the heap
+    constexpr static size_t sprite_bytes() {
+        return sizeof(int32_t) * 6 + sizeof(rgb565_tint) + sizeof(gfx::rgba_pixel<32>) * 2 + sizeof(gfx::srect16) +
+               sizeof(int16_t) * 2 + sizeof(uint16_t);
+    }
+    bool allocate(size_t count, void* (*alloc)(size_t)) {
+        deallocate();
+        block = alloc(count * sprite_bytes());
+        if (block == nullptr) {
+            return false;
+        }
+        // widest fields first so every array stays aligned
+        uint8_t* p = (uint8_t*)block;
+        tints = (rgb565_tint*)p;
+        p += count * sizeof(rgb565_tint);
+        xs = (int32_t*)p;
+        p += count * sizeof(int32_t);
+        ys = (int32_t*)p;
+        p += count * sizeof(int32_t);
+        x0s = (int32_t*)p;
+        p += count * sizeof(int32_t);
+        y0s = (int32_t*)p;
+        p += count * sizeof(int32_t);
+        dxs = (int32_t*)p;
+        p += count * sizeof(int32_t);
+        dys = (int32_t*)p;
+        p += count * sizeof(int32_t);
+        colors = (gfx::rgba_pixel<32>*)p;
+        p += count * sizeof(gfx::rgba_pixel<32>);
+        colors_next = (gfx::rgba_pixel<32>*)p;
+        p += count * sizeof(gfx::rgba_pixel<32>);
+        dirty = (gfx::srect16*)p;
+        p += count * sizeof(gfx::srect16);
+        cxs = (int16_t*)p;
+        p += count * sizeof(int16_t);
+        cys = (int16_t*)p;
+        p += count * sizeof(int16_t);
+        blends = (uint16_t*)p;
+        size = count;
+        capacity = count;
+        return true;
+    }
+    void deallocate() {
+        if (block != nullptr) {
+            free(block);
+            block = nullptr;
+        }
+        size = 0;
+        capacity = 0;
+    }
+};
+
+// a frame's sprite rects and tints, copied out of the live list and
+// binned into horizontal bands of band_lines rows. Composing a stripe
+// then only visits the sprites listed in the bands it covers, so the cost
+// follows the pixels covered instead of sprites times stripes. A sprite
+// spanning several bands is clipped to each band as it's drawn, so it's
+// never blended twice, and within a band sprites keep their list order.
+class sprite_bins {
+   public:
+    constexpr static const int16_t band_lines = 8;
+   private:
+    size_t m_capacity;
+    size_t m_items_capacity;
+    size_t m_size;
+    int16_t m_height;
+    int16_t m_bands;
+    rgb565_tint* m_tints;
+    int16_t* m_x1;
+    int16_t* m_y1;
+    int16_t* m_x2;
+    int16_t* m_y2;
+    uint32_t* m_band_starts;  // m_bands+1 offsets into m_items
+    uint16_t* m_items;        // sprite indices, band by band
+    void* m_block;
+    int16_t band_of(int16_t y) const {
+        return y < 0 ? 0 : (y >= m_height ? m_bands - 1 : y / band_lines);
+    }
+   public:
+    // sprite indices are 16 bits
+    constexpr static const size_t max_sprites = 0xFFFF;
+    sprite_bins() : m_capacity(0), m_items_capacity(0), m_size(0), m_height(0), m_bands(0), m_block(nullptr) {
+    }
+    sprite_bins(const sprite_bins& rhs) = delete;
+    sprite_bins& operator=(const sprite_bins& rhs) = delete;
+    ~sprite_bins() {
+        deallocate();
+    }
+    // room for capacity sprites of at most max_sprite_height rows over a
+    // surface height rows tall
+    bool allocate(size_t capacity, int16_t height, int16_t max_sprite_height, void* (*alloc)(size_t)) {
+        deallocate();
+        if (capacity > max_sprites || height < 1) {
+            return false;
+        }
+        const int16_t bands = (int16_t)((height + band_lines - 1) / band_lines);
+        // a sprite that doesn't start on a band boundary spills into one more
+        const size_t bands_per_sprite = (max_sprite_height + band_lines - 1) / band_lines + 1;
+        const size_t items_capacity = capacity * bands_per_sprite;
+        const size_t size = capacity * (sizeof(rgb565_tint) + sizeof(int16_t) * 4) + (bands + 1) * sizeof(uint32_t) +
+                            items_capacity * sizeof(uint16_t);
+        m_block = alloc(size);
+        if (m_block == nullptr) {
+            return false;
+        }
+        uint8_t* p = (uint8_t*)m_block;
+        m_tints = (rgb565_tint*)p;
+        p += capacity * sizeof(rgb565_tint);
+        m_band_starts = (uint32_t*)p;
+        p += (bands + 1) * sizeof(uint32_t);
+        m_x1 = (int16_t*)p;
+        p += capacity * sizeof(int16_t);
+        m_y1 = (int16_t*)p;
+        p += capacity * sizeof(int16_t);
+        m_x2 = (int16_t*)p;
+        p += capacity * sizeof(int16_t);
+        m_y2 = (int16_t*)p;
+        p += capacity * sizeof(int16_t);
+        m_items = (uint16_t*)p;
+        m_capacity = capacity;
+        m_items_capacity = items_capacity;
+        m_height = height;
+        m_bands = bands;
+        m_size = 0;
+        return true;
+    }
+    void deallocate() {
+        if (m_block != nullptr) {
+            free(m_block);
+            m_block = nullptr;
+        }
+        m_capacity = 0;
+        m_size = 0;
+        m_bands = 0;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    gfx::srect16 rect(size_t index) const {
+        return gfx::srect16(m_x1[index], m_y1[index], m_x2[index], m_y2[index]);
+    }
+    const rgb565_tint& tint(size_t index) const {
+        return m_tints[index];
+    }
+    // sprites listed in band, over every band
+    size_t items() const {
+        return m_bands == 0 ? 0 : m_band_starts[m_bands];
+    }
+    void clear() {
+        m_size = 0;
+    }
+    // adds a sprite (normalized rect), drawn over the ones before it
+    bool add(const gfx::srect16& rect, const rgb565_tint& tint) {
+        if (m_size == m_capacity) {
+            return false;
+        }
+        m_x1[m_size] = rect.x1;
+        m_y1[m_size] = rect.y1;
+        m_x2[m_size] = rect.x2;
+        m_y2[m_size] = rect.y2;
+        m_tints[m_size] = tint;
+        ++m_size;
+        return true;
+    }
+    // sorts the sprites into bands: counts, prefix sums, then fills, so
+    // it's two linear passes with no allocation
+    void bin() {
+        if (m_bands == 0) {
+            return;
+        }
+        for (int16_t b = 0; b <= m_bands; ++b) {
+            m_band_starts[b] = 0;
+        }
+        for (size_t i = 0; i < m_size; ++i) {
+            if (m_y2[i] < 0 || m_y1[i] >= m_height) {
+                continue;
+            }
+            const int16_t last = band_of(m_y2[i]);
+            for (int16_t b = band_of(m_y1[i]); b <= last; ++b) {
+                ++m_band_starts[b + 1];
+            }
+        }
+        for (int16_t b = 0; b < m_bands; ++b) {
+            m_band_starts[b + 1] += m_band_starts[b];
+        }
+        // m_band_starts[b] is now where band b starts. Filling advances
+        // each to where the next band starts, so shift back afterwards.
+        for (size_t i = 0; i < m_size; ++i) {
+            if (m_y2[i] < 0 || m_y1[i] >= m_height) {
+                continue;
+            }
+            const int16_t last = band_of(m_y2[i]);
+            for (int16_t b = band_of(m_y1[i]); b <= last; ++b) {
+                const uint32_t at = m_band_starts[b]++;
+                if (at < m_items_capacity) {
+                    m_items[at] = (uint16_t)i;
+                }
+            }
+        }
+        for (int16_t b = m_bands; b > 0; --b) {
+            m_band_starts[b] = m_band_starts[b - 1];
+        }
+        m_band_starts[0] = 0;
+    }
+    // blends every sprite over area of dst, rows of stride bytes whose
+    // first pixel is area's top left
+    void render(uint8_t* dst, size_t stride, const gfx::srect16& area) const {
+        if (m_bands == 0 || area.y2 < 0 || area.y1 >= m_height) {
+            return;
+        }
+        const int16_t last = band_of(area.y2);
+        for (int16_t b = band_of(area.y1); b <= last; ++b) {
+            const int16_t band_y1 = b * band_lines;
+            const int16_t y1 = area.y1 > band_y1 ? area.y1 : band_y1;
+            const int16_t y2 = area.y2 < band_y1 + band_lines - 1 ? area.y2 : band_y1 + band_lines - 1;
+            const uint32_t end = m_band_starts[b + 1] < m_items_capacity ? m_band_starts[b + 1] : (uint32_t)m_items_capacity;
+            for (uint32_t it = m_band_starts[b]; it < end; ++it) {
+                const size_t i = m_items[it];
+                const int16_t sx1 = m_x1[i] > area.x1 ? m_x1[i] : area.x1;
+                const int16_t sx2 = m_x2[i] < area.x2 ? m_x2[i] : area.x2;
+                const int16_t sy1 = m_y1[i] > y1 ? m_y1[i] : y1;
+                const int16_t sy2 = m_y2[i] < y2 ? m_y2[i] : y2;
+                if (sx1 > sx2 || sy1 > sy2) {
+                    continue;
+                }
+                rgb565_fill_blend(dst + (sy1 - area.y1) * stride + (sx1 - area.x1) * 2, stride, sx2 - sx1 + 1, sy2 - sy1 + 1,
+                                  m_tints[i]);
+            }
+        }
+    }
+};
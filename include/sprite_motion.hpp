@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+// closed-form bar motion. A point bouncing between two walls at a constant
+// speed is a triangle wave, so where it is after any number of ticks can be
+// worked out directly from where it started. Frames can be computed in any
+// order, dropped, or computed ahead, and always land on the same pose.
+
+// mixes a seed, a lane (which bar, which property) and a phase (which
+// step of it) into 32 well scrambled bits
+inline uint32_t sprite_hash(uint32_t seed, uint32_t lane, uint32_t phase) {
+    uint32_t h = seed ^ (lane * 0x9E3779B9U) ^ (phase * 0x85EBCA6BU);
+    h ^= h >> 16;
+    h *= 0x7FEB352DU;
+    h ^= h >> 15;
+    h *= 0x846CA68BU;
+    h ^= h >> 16;
+    return h;
+}
+
+// positions (24.8) ticks after each point was at its origin, moving by
+// its delta per nominal frame (256 ticks) and bouncing between lo and hi.
+// If directions isn't null it gets each delta with the sign it has now,
+// so the points can be handed over to sprite_integrate().
+inline void sprite_pose(const int32_t* origins, const int32_t* deltas, int32_t* positions, int32_t* directions,
+                        size_t size, int32_t lo, int32_t hi, int64_t ticks) {
+    const int32_t span = hi - lo;
+    if (span <= 0) {
+        for (size_t i = 0; i < size; ++i) {
+            positions[i] = lo;
+        }
+        return;
+    }
+    // the wave repeats every period, for every point on this axis, so the
+    // 64 bit reduction happens once instead of once per point
+    const int32_t period = span * 2;
+    int32_t phase = (int32_t)(ticks % period);
+    if (phase < 0) {
+        phase += period;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        int32_t u = (origins[i] - lo + deltas[i] * phase) % period;
+        if (u < 0) {
+            u += period;
+        }
+        const bool returning = u > span;
+        positions[i] = lo + (returning ? period - u : u);
+        if (directions != nullptr) {
+            directions[i] = returning ? -deltas[i] : deltas[i];
+        }
+    }
+}
@@ -0,0 +1,367 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_stats.hpp"
+#include "sprite_list.hpp"
+
+// moves a 24.8 coordinate, bouncing it between lo and hi
+inline int32_t sprite_bounce(int32_t value, int32_t lo, int32_t hi, int32_t& delta, int32_t ticks) {
+    value += delta * ticks;
+    if (value < lo) {
+        value = lo + (lo - value);
+        delta = -delta;
+    } else if (value > hi) {
+        value = hi - (value - hi);
+        delta = -delta;
+    }
+    return value;
+}
+
+#if defined(__GNUC__)
+// four 24.8 coordinates at once. GCC lowers these to SSE/NEON on the host
+// and to plain scalar code where there's no vector unit, like the ESP32.
+typedef int32_t sprite_vec4 __attribute__((vector_size(16)));
+#endif
+
+// sprite_bounce() over a whole axis: positions and deltas are separate
+// arrays, so the bounce turns into compares and masks with no branches
+inline void sprite_integrate(int32_t* positions, int32_t* deltas, size_t size, int32_t lo, int32_t hi, int32_t ticks) {
+    size_t i = 0;
+#if defined(__GNUC__)
+    const sprite_vec4 lo4 = {lo, lo, lo, lo};
+    const sprite_vec4 hi4 = {hi, hi, hi, hi};
+    const size_t vector_size = size & ~(size_t)3;
+    for (; i < vector_size; i += 4) {
+        sprite_vec4 p, d;
+        memcpy(&p, positions + i, sizeof(p));
+        memcpy(&d, deltas + i, sizeof(d));
+        p += d * ticks;
+        // compares give -1 in the lanes where they hold
+        const sprite_vec4 under = p < lo4;
+        const sprite_vec4 over = p > hi4;
+        const sprite_vec4 flip = under | over;
+        p = (under & (lo4 + lo4 - p)) | (over & (hi4 + hi4 - p)) | (~flip & p);
+        d = (d ^ flip) - flip;
+        memcpy(positions + i, &p, sizeof(p));
+        memcpy(deltas + i, &d, sizeof(d));
+    }
+#endif
+    for (; i < size; ++i) {
+        positions[i] = sprite_bounce(positions[i], lo, hi, deltas[i], ticks);
+    }
+}
+
+// moves a sprite_list and, optionally, makes the sprites collide with each
+// other. The centers are hashed into a uniform grid of cells one sprite
+// wide, so a sprite can only touch sprites in its own cell or the eight
+// around it, and each pair is tested once. Overlapping sprites are pushed
+// apart along the shallower axis and swap their deltas on it. The budget
+// covers the whole step: the grid isn't built if the last one wouldn't fit
+// in what's left, and collisions stop before a chunk that would run past
+// it. The next frame picks up where this one stopped, so a huge list
+// degrades into collisions being resolved over several frames instead of
+// stalling one.
+class sprite_physics {
+   public:
+    constexpr static const uint32_t default_budget_us = 2000;
+   private:
+    size_t m_capacity;
+    int16_t m_cell_size;
+    int16_t m_columns;
+    int16_t m_rows;
+    uint32_t* m_cell_starts;  // m_columns*m_rows+1 offsets into m_items
+    uint16_t* m_items;        // sprite indices, cell by cell
+    uint32_t* m_cells;        // each sprite's cell
+    void* m_block;
+    uint32_t m_budget_us;
+    size_t m_resume;     // the sprite the next collision pass starts from
+    uint32_t m_hash_us;  // how long the last grid build took
+    uint32_t m_chunk;    // pairs tested between looks at the clock
+    // since the last reset_counters()
+    uint32_t m_steps;
+    uint32_t m_over_budget;
+    uint32_t m_pairs;
+    uint32_t m_contacts;
+    uint32_t m_max_us;
+    uint32_t m_last_us;
+    // about how long the collision pass runs between looks at the clock.
+    // Chunks of pair tests are resized from the last one's time to take
+    // this long.
+    constexpr static const uint32_t check_us = 50;
+    constexpr static const uint32_t max_chunk = 1 << 14;
+    int16_t cell_of(int32_t value, int16_t cells) const {
+        const int32_t cell = ((value + 128) >> 8) / m_cell_size;
+        return cell < 0 ? 0 : (cell >= cells ? cells - 1 : (int16_t)cell);
+    }
+    // counting sort of the sprites by cell, like sprite_bins::bin()
+    void hash(const sprite_list& sprites) {
+        const size_t cell_count = (size_t)m_columns * m_rows;
+        for (size_t c = 0; c <= cell_count; ++c) {
+            m_cell_starts[c] = 0;
+        }
+        for (size_t i = 0; i < sprites.size; ++i) {
+            m_cells[i] = (uint32_t)cell_of(sprites.ys[i], m_rows) * m_columns + cell_of(sprites.xs[i], m_columns);
+            ++m_cell_starts[m_cells[i] + 1];
+        }
+        for (size_t c = 0; c < cell_count; ++c) {
+            m_cell_starts[c + 1] += m_cell_starts[c];
+        }
+        for (size_t i = 0; i < sprites.size; ++i) {
+            m_items[m_cell_starts[m_cells[i]]++] = (uint16_t)i;
+        }
+        for (size_t c = cell_count; c > 0; --c) {
+            m_cell_starts[c] = m_cell_starts[c - 1];
+        }
+        m_cell_starts[0] = 0;
+    }
+    static int32_t clamp(int32_t value, int32_t lo, int32_t hi) {
+        return value < lo ? lo : (value > hi ? hi : value);
+    }
+    // separates one axis of a pair that overlaps by depth, and swaps their
+    // deltas if they're still closing
+    static void resolve(int32_t* positions, int32_t* deltas, size_t a, size_t b, int32_t depth, int32_t lo, int32_t hi) {
+        const bool a_first = positions[a] <= positions[b];
+        const size_t first = a_first ? a : b, second = a_first ? b : a;
+        positions[first] = clamp(positions[first] - depth / 2, lo, hi);
+        positions[second] = clamp(positions[second] + depth - depth / 2, lo, hi);
+        if (deltas[first] > deltas[second]) {
+            const int32_t delta = deltas[first];
+            deltas[first] = deltas[second];
+            deltas[second] = delta;
+        }
+    }
+    void collide_pair(sprite_list& sprites, size_t a, size_t b, int32_t extent, int32_t x_lo, int32_t x_hi, int32_t y_lo,
+                      int32_t y_hi) {
+        ++m_pairs;
+        const int32_t dx = abs(sprites.xs[a] - sprites.xs[b]);
+        const int32_t dy = abs(sprites.ys[a] - sprites.ys[b]);
+        if (dx >= extent || dy >= extent) {
+            return;
+        }
+        ++m_contacts;
+        if (extent - dx < extent - dy) {
+            resolve(sprites.xs, sprites.dxs, a, b, extent - dx, x_lo, x_hi);
+        } else {
+            resolve(sprites.ys, sprites.dys, a, b, extent - dy, y_lo, y_hi);
+        }
+    }
+    // calls visit with every sprite that could touch sprite i and comes
+    // after it: the rest of its cell, then the cells right, below left,
+    // below and below right of it. Over every i that's each pair once.
+    // Stops early, returning false, if visit does.
+    template <typename Visit>
+    bool neighbors(size_t i, Visit visit) const {
+        const int16_t column = (int16_t)(m_cells[i] % m_columns), row = (int16_t)(m_cells[i] / m_columns);
+        static const int8_t offsets[5][2] = {{0, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        for (size_t o = 0; o < 5; ++o) {
+            const int16_t c = column + offsets[o][0], r = row + offsets[o][1];
+            if (c < 0 || c >= m_columns || r >= m_rows) {
+                continue;
+            }
+            const size_t cell = (size_t)r * m_columns + c;
+            for (uint32_t it = m_cell_starts[cell]; it < m_cell_starts[cell + 1]; ++it) {
+                const size_t j = m_items[it];
+                if (o == 0 && j <= i) {
+                    continue;
+                }
+                if (!visit(j)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    // the collision pass from m_resume on, looking at the clock every
+    // m_chunk pair tests, until every sprite is done or the next chunk
+    // could overrun the budget. Chunks count pairs rather than sprites
+    // because one sprite in a crowded cell can have hundreds of them.
+    void collide(sprite_list& sprites, int16_t extent, int32_t x_lo, int32_t x_hi, int32_t y_lo, int32_t y_hi,
+                 uint32_t start_us, uint32_t mark_us) {
+        const int32_t extent_fixed = (int32_t)extent << 8;
+        if (m_resume >= sprites.size) {
+            m_resume = 0;
+        }
+        // what the next chunk is expected to take
+        uint32_t next_us = check_us;
+        uint32_t tested = 0;
+        auto visit = [&](size_t i, size_t j) {
+            collide_pair(sprites, i, j, extent_fixed, x_lo, x_hi, y_lo, y_hi);
+            if (++tested < m_chunk) {
+                return true;
+            }
+            tested = 0;
+            const uint32_t now_us = frame_stats::now_us();
+            const uint32_t chunk_us = now_us - mark_us;
+            mark_us = now_us;
+            // size the next chunk to take about check_us, growing at most
+            // twofold at a time
+            uint32_t chunk = m_chunk * 2;
+            if (chunk_us != 0 && (uint64_t)m_chunk * check_us / chunk_us < chunk) {
+                chunk = (uint32_t)((uint64_t)m_chunk * check_us / chunk_us);
+            }
+            m_chunk = chunk < 1 ? 1 : (chunk > max_chunk ? max_chunk : chunk);
+            next_us = chunk_us > check_us ? chunk_us : check_us;
+            // a chunk's worth in reserve, for one that runs long
+            return now_us - start_us + next_us * 2 < m_budget_us;
+        };
+        for (size_t n = 0; n < sprites.size; ++n) {
+            size_t i = m_resume + n;
+            if (i >= sprites.size) {
+                i -= sprites.size;
+            }
+            if (!neighbors(i, [&](size_t j) { return visit(i, j); })) {
+                // the next frame starts after this sprite, even if some of
+                // its pairs went untested, so one that never fits can't
+                // hold up the rest
+                m_resume = i + 1;
+                ++m_over_budget;
+                return;
+            }
+        }
+    }
+   public:
+    sprite_physics()
+        : m_capacity(0), m_cell_size(1), m_columns(0), m_rows(0), m_block(nullptr), m_budget_us(default_budget_us), m_resume(0),
+          m_hash_us(0), m_chunk(64) {
+        reset_counters();
+    }
+    sprite_physics(const sprite_physics& rhs) = delete;
+    sprite_physics& operator=(const sprite_physics& rhs) = delete;
+    ~sprite_physics() {
+        deallocate();
+    }
+    // room for capacity sprites whose rects are extent pixels square, over
+    // a width x height area
+    bool allocate(size_t capacity, int16_t width, int16_t height, int16_t extent, void* (*alloc)(size_t)) {
+        deallocate();
+        if (capacity > sprite_bins::max_sprites || width < 1 || height < 1 || extent < 1) {
+            return false;
+        }
+        const int16_t columns = (int16_t)((width + extent - 1) / extent);
+        const int16_t rows = (int16_t)((height + extent - 1) / extent);
+        const size_t cell_count = (size_t)columns * rows;
+        m_block = alloc((cell_count + 1 + capacity) * sizeof(uint32_t) + capacity * sizeof(uint16_t));
+        if (m_block == nullptr) {
+            return false;
+        }
+        uint8_t* p = (uint8_t*)m_block;
+        m_cell_starts = (uint32_t*)p;
+        p += (cell_count + 1) * sizeof(uint32_t);
+        m_cells = (uint32_t*)p;
+        p += capacity * sizeof(uint32_t);
+        m_items = (uint16_t*)p;
+        m_capacity = capacity;
+        m_cell_size = extent;
+        m_columns = columns;
+        m_rows = rows;
+        m_resume = 0;
+        m_hash_us = 0;
+        m_chunk = 64;
+        return true;
+    }
+    void deallocate() {
+        if (m_block != nullptr) {
+            free(m_block);
+            m_block = nullptr;
+        }
+        m_capacity = 0;
+        m_columns = 0;
+        m_rows = 0;
+    }
+    // how long one step may take before collisions are deferred
+    uint32_t budget_us() const {
+        return m_budget_us;
+    }
+    void budget_us(uint32_t value) {
+        m_budget_us = value;
+    }
+    // moves every sprite by ticks (8.8 nominal frames), bouncing their
+    // centers between the lo and hi bounds (24.8), then collides them if
+    // collisions is set
+    void step(sprite_list& sprites, int16_t extent, int32_t x_lo, int32_t x_hi, int32_t y_lo, int32_t y_hi, int32_t ticks,
+              bool collisions) {
+        const uint32_t start_us = frame_stats::now_us();
+        sprite_integrate(sprites.xs, sprites.dxs, sprites.size, x_lo, x_hi, ticks);
+        sprite_integrate(sprites.ys, sprites.dys, sprites.size, y_lo, y_hi, ticks);
+        if (collisions && m_block != nullptr && sprites.size <= m_capacity && sprites.size > 1) {
+            uint32_t mark_us = frame_stats::now_us();
+            if (mark_us - start_us + m_hash_us >= m_budget_us) {
+                // the grid alone wouldn't fit. Trust that estimate less
+                // each time, so one slow build can't stop collisions for good.
+                m_hash_us /= 2;
+                ++m_over_budget;
+            } else {
+                hash(sprites);
+                const uint32_t hashed_us = frame_stats::now_us();
+                m_hash_us = hashed_us - mark_us;
+                mark_us = hashed_us;
+                collide(sprites, extent, x_lo, x_hi, y_lo, y_hi, start_us, mark_us);
+            }
+        }
+        m_last_us = frame_stats::now_us() - start_us;
+        if (m_last_us > m_max_us) {
+            m_max_us = m_last_us;
+        }
+        ++m_steps;
+    }
+    // counts the pairs of sprites extent pixels square that overlap now,
+    // through the grid but without moving anything
+    size_t overlaps(const sprite_list& sprites, int16_t extent) {
+        if (m_block == nullptr || sprites.size > m_capacity) {
+            return 0;
+        }
+        hash(sprites);
+        const int32_t extent_fixed = (int32_t)extent << 8;
+        size_t result = 0;
+        for (size_t i = 0; i < sprites.size; ++i) {
+            neighbors(i, [&](size_t j) {
+                if (abs(sprites.xs[i] - sprites.xs[j]) < extent_fixed && abs(sprites.ys[i] - sprites.ys[j]) < extent_fixed) {
+                    ++result;
+                }
+                return true;
+            });
+        }
+        return result;
+    }
+    // how long the last step took
+    uint32_t last_us() const {
+        return m_last_us;
+    }
+    uint32_t steps() const {
+        return m_steps;
+    }
+    // steps that ran out of budget before every sprite was collided
+    uint32_t over_budget() const {
+        return m_over_budget;
+    }
+    // pairs tested and pairs found overlapping
+    uint32_t pairs() const {
+        return m_pairs;
+    }
+    uint32_t contacts() const {
+        return m_contacts;
+    }
+    uint32_t max_us() const {
+        return m_max_us;
+    }
+    void reset_counters() {
+        m_steps = 0;
+        m_over_budget = 0;
+        m_pairs = 0;
+        m_contacts = 0;
+        m_max_us = 0;
+        m_last_us = 0;
+    }
+    // one line summing up the steps since the last reset
+    void print() const {
+        if (m_steps == 0) {
+            return;
+        }
+        printf("physics: %u steps, max %uus of %uus, %u over budget, %.1f pairs/step, %.1f contacts/step\n",
+               (unsigned)m_steps, (unsigned)m_max_us, (unsigned)m_budget_us, (unsigned)m_over_budget,
+               (double)m_pairs / m_steps, (double)m_contacts / m_steps);
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+// hands out the stripes of a frame to up to Workers renderers. Each
+// worker starts with an even, contiguous share and takes from the front of
+// it. Once its share runs out it steals from the back of whichever share
+// has the most left, so a worker that got cheap stripes (or started late)
+// picks up the slack instead of idling. A share is one packed begin/end
+// word, so taking and stealing are both a single compare and swap.
+template<size_t Workers>
+class stripe_scheduler {
+    static_assert(Workers > 0, "stripe_scheduler needs at least one worker");
+    std::atomic<uint32_t> m_shares[Workers];  // begin << 16 | end
+    std::atomic<uint32_t> m_stolen;
+    std::atomic<size_t> m_workers;
+    static uint32_t pack(uint32_t begin, uint32_t end) {
+        return (begin << 16) | end;
+    }
+    static uint32_t begin_of(uint32_t share) {
+        return share >> 16;
+    }
+    static uint32_t end_of(uint32_t share) {
+        return share & 0xFFFF;
+    }
+   public:
+    constexpr static const size_t max_workers = Workers;
+    constexpr static const size_t max_stripes = 0xFFFF;
+    stripe_scheduler() : m_stolen(0), m_workers(1) {
+        for (size_t i = 0; i < Workers; ++i) {
+            m_shares[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    // splits stripes 0 to count-1 between the first workers. Everything
+    // the stripes refer to must be written before this is called.
+    void start(size_t count, size_t workers) {
+        if (workers < 1) {
+            workers = 1;
+        } else if (workers > Workers) {
+            workers = Workers;
+        }
+        if (count > max_stripes) {
+            count = max_stripes;
+        }
+        m_workers.store(workers, std::memory_order_relaxed);
+        for (size_t i = 0; i < Workers; ++i) {
+            const uint32_t begin = i < workers ? (uint32_t)(count * i / workers) : 0;
+            const uint32_t end = i < workers ? (uint32_t)(count * (i + 1) / workers) : 0;
+            m_shares[i].store(pack(begin, end), std::memory_order_release);
+        }
+    }
+    // claims the next stripe for worker into out_index. Returns false
+    // once every stripe has been claimed.
+    bool next(size_t worker, size_t* out_index) {
+        std::atomic<uint32_t>& own = m_shares[worker];
+        uint32_t share = own.load(std::memory_order_acquire);
+        while (begin_of(share) < end_of(share)) {
+            if (own.compare_exchange_weak(share, pack(begin_of(share) + 1, end_of(share)), std::memory_order_acq_rel)) {
+                *out_index = begin_of(share);
+                return true;
+            }
+        }
+        // out of our own: steal the last stripe of the biggest share
+        while (true) {
+            size_t victim = worker;
+            uint32_t victim_left = 0;
+            const size_t workers = m_workers.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < workers; ++i) {
+                const uint32_t s = m_shares[i].load(std::memory_order_acquire);
+                const uint32_t left = begin_of(s) < end_of(s) ? end_of(s) - begin_of(s) : 0;
+                if (left > victim_left) {
+                    victim = i;
+                    victim_left = left;
+                }
+            }
+            if (victim_left == 0) {
+                return false;
+            }
+            uint32_t s = m_shares[victim].load(std::memory_order_acquire);
+            if (begin_of(s) < end_of(s) &&
+                m_shares[victim].compare_exchange_strong(s, pack(begin_of(s), end_of(s) - 1), std::memory_order_acq_rel)) {
+                *out_index = end_of(s) - 1;
+                m_stolen.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    // stripes taken from another worker's share since the last reset
+    uint32_t stolen() const {
+        return m_stolen.load(std::memory_order_relaxed);
+    }
+    void reset_stolen() {
+        m_stolen.store(0, std::memory_order_relaxed);
+    }
+};
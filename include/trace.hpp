@@ -0,0 +1,171 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+// fixed-size ring of timestamped begin/end events for the render and
+// flush pipeline, dumped as Chrome trace JSON for chrome://tracing or
+// Perfetto. Recording is a single atomic increment plus a few small
+// stores, so it's safe from either core and from the flush-done ISR. The
+// oldest events are overwritten once the ring wraps.
+//
+// Each task records on its own track, so the begin/end pairs of tasks
+// sharing a core don't interleave. Spans that start and end in different
+// tasks or in an ISR go on an explicit track instead, like dma_track.
+class trace_buffer {
+   public:
+    enum event_name {
+        frame = 0,    // a whole loop() iteration
+        paint,        // composing one stripe
+        flush,        // queuing one transfer (panel_on_flush)
+        flush_ready,  // the DMA done ISR (instant)
+        dma,          // one transfer in flight, on its own track
+        flush_wait,   // waiting for a free transfer buffer
+        bg_task,      // bg_task composing a background
+        name_count
+    };
+    constexpr static const size_t capacity = 1024;
+    // tracks: dma_track, then one per task that records, in the order
+    // they first do. Tasks past the last one share it.
+    constexpr static const uint8_t max_tracks = 16;
+    constexpr static const uint8_t dma_track = 0;
+   private:
+    // seq is the event's index plus one once it's written, and 0 while
+    // it's being written, so dump() can tell a slot is whole
+    struct event {
+        std::atomic<uint32_t> seq;
+        std::atomic<uint32_t> ts_us;
+        std::atomic<uint8_t> name;
+        std::atomic<char> phase;  // 'B'egin, 'E'nd or 'i'nstant
+        std::atomic<uint8_t> track;
+    };
+    event m_events[capacity];
+    std::atomic<uint32_t> m_head;
+    std::atomic<bool> m_enabled;
+    void record(event_name name, char phase, uint8_t track) {
+        if (!m_enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        const uint32_t index = m_head.fetch_add(1, std::memory_order_relaxed);
+        event& e = m_events[index % capacity];
+        // released, so a reader that sees any of the new fields sees
+        // the 0 before them
+        e.seq.store(0, std::memory_order_relaxed);
+        e.ts_us.store((uint32_t)esp_timer_get_time(), std::memory_order_release);
+        e.name.store((uint8_t)name, std::memory_order_release);
+        e.phase.store(phase, std::memory_order_release);
+        e.track.store(track, std::memory_order_release);
+        e.seq.store(index + 1, std::memory_order_release);
+    }
+    // the task names of the tracks handed out so far, shared by every
+    // trace_buffer
+    static std::atomic<const char*>* track_names() {
+        static std::atomic<const char*> names[max_tracks];
+        return names;
+    }
+    static std::atomic<uint8_t>& track_count() {
+        static std::atomic<uint8_t> count(dma_track + 1);
+        return count;
+    }
+    // the calling task's track, handed out the first time it records
+    static uint8_t task_track() {
+        static thread_local uint8_t track = dma_track;
+        if (track == dma_track) {
+            uint8_t next = track_count().fetch_add(1, std::memory_order_relaxed);
+            if (next >= max_tracks - 1) {
+                next = max_tracks - 1;
+                track_count().store(max_tracks, std::memory_order_relaxed);
+                track_names()[next].store("other tasks", std::memory_order_release);
+            } else {
+                track_names()[next].store(pcTaskGetName(nullptr), std::memory_order_release);
+            }
+            track = next;
+        }
+        return track;
+    }
+   public:
+    trace_buffer() : m_head(0), m_enabled(true) {
+        for (size_t i = 0; i < capacity; ++i) {
+            m_events[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+    static const char* name(event_name value) {
+        static const char* names[name_count] = {"frame", "paint", "flush", "flush_ready", "dma", "flush_wait", "bg_task"};
+        return names[value];
+    }
+    // begin/end on the calling task's track. Not from an ISR.
+    void begin(event_name name) {
+        record(name, 'B', task_track());
+    }
+    void end(event_name name) {
+        record(name, 'E', task_track());
+    }
+    void instant(event_name name) {
+        record(name, 'i', task_track());
+    }
+    // the same on an explicit track, for spans that start and end in
+    // different tasks or in an ISR
+    void begin(event_name name, uint8_t track) {
+        record(name, 'B', track);
+    }
+    void end(event_name name, uint8_t track) {
+        record(name, 'E', track);
+    }
+    void instant(event_name name, uint8_t track) {
+        record(name, 'i', track);
+    }
+    bool enabled() const {
+        return m_enabled;
+    }
+    void enabled(bool value) {
+        m_enabled = value;
+    }
+    void clear() {
+        m_head = 0;
+        for (size_t i = 0; i < capacity; ++i) {
+            m_events[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+    // writes the recorded events, oldest first, as Chrome trace JSON.
+    // Recording is paused while dumping so the ring holds still. A slot a
+    // writer is still in, or has moved on past, is left out.
+    void dump(FILE* file) {
+        const bool was_enabled = m_enabled.exchange(false);
+        const uint32_t head = m_head.load();
+        const uint32_t size = head < capacity ? head : (uint32_t)capacity;
+        fputs("{\"traceEvents\":[\n", file);
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"dma\"}}\n",
+                (unsigned)dma_track);
+        const uint8_t tracks = track_count().load(std::memory_order_relaxed);
+        for (uint8_t i = dma_track + 1; i < tracks && i < max_tracks; ++i) {
+            const char* track_name = track_names()[i].load(std::memory_order_acquire);
+            fprintf(file, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}\n",
+                    (unsigned)i, track_name == nullptr ? "task" : track_name);
+        }
+        for (uint32_t i = head - size; i != head; ++i) {
+            const event& e = m_events[i % capacity];
+            if (e.seq.load(std::memory_order_acquire) != i + 1) {
+                continue;
+            }
+            const uint32_t ts_us = e.ts_us.load(std::memory_order_acquire);
+            const uint8_t name_index = e.name.load(std::memory_order_acquire);
+            const char phase = e.phase.load(std::memory_order_acquire);
+            const uint8_t track = e.track.load(std::memory_order_acquire);
+            // still the same event, not one a late writer started over it
+            if (e.seq.load(std::memory_order_relaxed) != i + 1 || name_index >= name_count) {
+                continue;
+            }
+            fprintf(file, ",{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":0,\"tid\":%u%s}\n",
+                    name((event_name)name_index),
+                    phase,
+                    (unsigned)ts_us,
+                    (unsigned)track,
+                    phase == 'i' ? ",\"s\":\"t\"" : "");
+        }
+        fputs("]}\n", file);
+        m_enabled = was_enabled;
+    }
+};
@@ -10,12 +10,26 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <atomic>
 
 #include <gfx.hpp>
 #include <uix.hpp>
+#include "rgb565.hpp"
+#include "frame_stats.hpp"
+#include "trace.hpp"
+#include "flush_planner.hpp"
+#include "boot_times.hpp"
+#include "sprite_list.hpp"
+#include "sprite_physics.hpp"
+#include "sprite_motion.hpp"
+#include "animation_clock.hpp"
 
-extern gfx::const_buffer_stream warhol_stm;
-gfx::jpg_image warhol_img(warhol_stm);
+// loads the background image into dst, a width x height RGB565 buffer in
+// panel byte order, from whichever asset format the build embeds
+bool warhol_load(uint8_t* dst, uint16_t width, uint16_t height);
+// the background's pixels mapped straight from flash, in the same layout,
+// or nullptr if there's no usable one and it has to be loaded into RAM
+const uint8_t* warhol_map(uint16_t width, uint16_t height);
 // colors for the UI
 using color_t = gfx::color<gfx::rgb_pixel<16>>; // native
 using color32_t = gfx::color<gfx::rgba_pixel<32>>; // uix
@@ -35,86 +49,247 @@ class warhol_box : public uix::control<ControlSurfaceType> {
     using bitmap_type = gfx::bitmap<pixel_type, palette_type>;
     using color_type = gfx::color<pixel_type>;
     using color32_type = gfx::color<gfx::rgba_pixel<32>>;
+    static_assert(pixel_type::bit_depth==16,"warhol_box requires an RGB565 surface");
+    // everything render() reads that the animation changes. Composing
+    // from a snapshot lets one frame be composed while on_after_paint()
+    // already moves the bars for the next.
+    struct frame_state {
+        const uint8_t* background; // the source image, or the front frame
+        bool tinted; // the background still needs background_tint
+        rgb565_tint background_tint;
+        const sprite_bins* sprites;
+        int scale; // 2 composes background and sprites at half size into half
+        uint8_t* half;
+    };
    private:
 #ifndef ARDUINO
     static uint32_t millis() { return pdTICKS_TO_MS(xTaskGetTickCount()); }
     static int random() { return rand(); }
     static void randomSeed(int value) {return srand(value);}
 #endif
-    int draw_state;
-    bitmap_type m_bmp;
-    bitmap_type m_bmp2;
-    bitmap_type m_bmp3;
-    bitmap_type* m_current_bmp;
-    constexpr static const size_t count = 3;
-    constexpr static const int16_t size = 60;
-    gfx::spoint16 pts[count];        // locations
-    gfx::spoint16 dts[count];        // deltas
-    gfx::rgba_pixel<32> cls[count];  // colors
-    gfx::rgba_pixel<32> cls_next[count];
-    float cls_blend[count];
-    gfx::rgba_pixel<32> bg; // background color
-    gfx::rgba_pixel<32> bg_next;
-    float bg_blend;
-    TaskHandle_t bg_task_handle;
+    int draw_state = 0;
+    constexpr static const uint16_t bg_width = 320;
+    constexpr static const uint16_t bg_height = 240;
+    bitmap_type m_bmp = bitmap_type({0,0},nullptr); // the decoded source image, unless it's mapped
+    const uint8_t* m_source = nullptr; // the source image pixels: m_bmp or flash
+    // tinted backgrounds, double buffered between bg_task and the paint
+    // side. The paint side owns m_front. bg_task composes into the other
+    // one, and only between a request and its m_bg_ready: changed() only
+    // swaps the two once bg_task is done and idle again.
+    constexpr static const size_t frame_count = 2;
+    bitmap_type m_frames[frame_count] = {bitmap_type({0,0},nullptr),bitmap_type({0,0},nullptr)};
+    gfx::rgba_pixel<32> m_frame_tints[frame_count]{}; // tint baked into each frame
+    size_t m_front = 0;
+    gfx::rgba_pixel<32> m_paint_tint{}; // tint of the background on screen
+    // in direct mode there are no tinted frames or bg_task. The tint is
+    // applied to the source image while composing each stripe.
+    bool m_direct = false;
+    rgb565_tint m_direct_tint = {};
+    // internal RAM strip on_paint composes into before handing it to UIX
+    constexpr static const size_t scratch_lines = 8;
+    uint8_t* m_scratch = nullptr;
+    bool m_dirty_tracking = true;
+    constexpr static const size_t changed_capacity = 8;
+    flush_planner<changed_capacity> m_planner; // coalesces the dirty rects
+    bool m_coalesce = true;
+    // the bars: any number, each size x size (plus the center line)
+    size_t m_sprite_count = default_sprites;
+    int16_t m_sprite_size = default_sprite_size;
+    sprite_list m_sprites;
+    sprite_bins m_bins; // the last snapshot's sprites
+    // half resolution direct mode: the scene is composed at 160x120 into
+    // internal RAM and pixel doubled into each stripe
+    uint8_t m_render_scale = 1;
+    uint8_t* m_half = nullptr; // the composed scene
+    uint8_t* m_source_half = nullptr; // the source image scaled down
+    sprite_bins m_half_bins; // the last snapshot's sprites, at half size
+    sprite_physics m_physics; // moves the bars
+    bool m_collisions = false; // bars bounce off each other, not just the edges
+    frame_state m_state = {}; // what on_paint composes from
+    bool m_state_stale = true; // the bars moved since m_state was taken
+    // the animation runs in 8.8 fixed point "ticks" of nominal frames at
+    // anim_fps since it started. Every pose and color is worked out from
+    // the tick count and the seed, so a frame doesn't depend on the ones
+    // before it and dropped frames don't slow the animation down.
+    constexpr static const int anim_fps = 30;
+    constexpr static const uint16_t blend_one = 256; // 1.0 in 8.8
+    constexpr static const uint16_t blend_step = 26; // ~0.1 per nominal frame
+    // nominal frames between background tint steps
+    constexpr static const int bg_frames = 8;
+    // the longest a stall can advance the bars while collisions are on
+    constexpr static const uint32_t max_step_ticks = anim_fps*256/10;
+    // sprite_hash() lanes: four per bar, then one for the background
+    constexpr static const uint32_t bar_color_lane = 0, bar_x_lane = 1, bar_y_lane = 2, bar_delta_lane = 3;
+    constexpr static const uint32_t bg_lane = 0xFFFFFFFF;
+    uint32_t m_seed = 0;
+    bool m_seed_set = false;
+    uint32_t m_anim_start_ms = 0; // when the animation was at tick 0
+    uint32_t m_anim_ticks = 0; // the ticks of the last frame
+    uint32_t m_frame_ms = 0; // what the next after_paint animates to, if m_frame_ms_set
+    bool m_frame_ms_set = false;
+    bool m_paused = false;
+    uint32_t m_paused_ms = 0; // when it paused
+    animation_clock* m_clock = nullptr; // told when the next frame is due, if anything
+    int m_clock_client = animation_clock::no_client;
+    uint32_t m_motion_origin = 0; // the ticks the bars were at x0s, y0s
+    bool m_integrated = false; // the physics steps the bars instead of posing them
+    uint32_t m_bar_phase = 0; // the color step colors and colors_next hold
+    uint16_t m_tint_blend = 0; // the blend the bar tints were last made for
+    size_t m_active = 0; // bars drawn and moved, 0 for all of them
+    uint8_t m_blend_bits = 8; // of the bar color blend
+    uint8_t m_bg_stride = 1; // background tint steps per repaint
+    bool m_repaint_all = false; // the next changed() covers the whole control
+    uint32_t m_bg_step = 0; // the background tint step that's due
+    gfx::rgba_pixel<32> m_bg_tint{}; // and its tint
+    uint32_t m_bg_wanted = 0; // the step last asked of bg_task
+    TaskHandle_t bg_task_handle = nullptr;
+    std::atomic<uint32_t> m_bg_request{0}; // the tint step bg_task renders next
+    std::atomic<uint32_t> m_bg_ready{no_step}; // the step in bg_task's finished back frame
+    std::atomic<uint32_t> m_bg_produced{0};
+    uint32_t m_bg_consumed = 0;
+    frame_stats* m_stats = nullptr; // where to record stage timings, if anywhere
+    trace_buffer* m_trace = nullptr; // where to record trace events, if anywhere
+    boot_times* m_boot = nullptr; // where to record startup phases, if anywhere
+    // given by preload_task once the source is in place
+    SemaphoreHandle_t m_preload_done = nullptr;
     static void* alloc(size_t size) {
         return heap_caps_malloc(size,MALLOC_CAP_SPIRAM);
     }
+    static void* alloc_internal(size_t size) {
+        return heap_caps_malloc(size,MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT);
+    }
+    static rgb565_tint make_tint(const gfx::rgba_pixel<32>& px) {
+        return rgb565_make_tint(px.template channel<gfx::channel_name::R>(),
+                                px.template channel<gfx::channel_name::G>(),
+                                px.template channel<gfx::channel_name::B>(),
+                                px.template channel<gfx::channel_name::A>());
+    }
+    // copies the source image into dst and tints it in one pass, so PSRAM
+    // is read and written once per frame instead of twice
+    void compose_background(bitmap_type& dst, const gfx::rgba_pixel<32>& tint) {
+        rgb565_blend(dst.begin(),m_source,(size_t)bg_width*bg_height,make_tint(tint));
+    }
+    // maps the source image, or allocates m_bmp and loads it there
+    bool load_source() {
+        const uint8_t* mapped = warhol_map(bg_width,bg_height);
+        if(mapped!=nullptr) {
+            m_source = mapped;
+        } else {
+            m_bmp = gfx::create_bitmap<pixel_type,palette_type>(gfx::size16(bg_width,bg_height),alloc,this->palette());
+            if(!m_bmp.begin()) {
+                m_bmp = bitmap_type({0,0},nullptr);
+                return false;
+            }
+            m_bmp.fill(m_bmp.bounds(),pixel_type());
+            if(!warhol_load(m_bmp.begin(),bg_width,bg_height)) {
+                free(m_bmp.begin());
+                m_bmp = bitmap_type({0,0},nullptr);
+                return false;
+            }
+            m_source = m_bmp.begin();
+        }
+        if(m_boot!=nullptr) {
+            m_boot->mark(boot_times::source);
+        }
+        return true;
+    }
+    static void preload_task(void* arg) {
+        warhol_box& me = *(warhol_box*)arg;
+        me.load_source();
+        xSemaphoreGive(me.m_preload_done);
+        vTaskDelete(nullptr);
+    }
+    // waits for a preload if one was started. Returns true if it ran,
+    // whether or not it managed to load anything.
+    bool wait_preload() {
+        if(m_preload_done==nullptr) {
+            return false;
+        }
+        xSemaphoreTake(m_preload_done,portMAX_DELAY);
+        vSemaphoreDelete(m_preload_done);
+        m_preload_done = nullptr;
+        return true;
+    }
     static void bg_task(void* arg) {
         warhol_box& me = *(warhol_box*)arg;
         while(1) {
-            if(me.m_current_bmp!=&me.m_bmp2) {
-                if(me.m_bmp2.begin()) {
-                    memcpy(me.m_bmp2.begin(),me.m_bmp.begin(),bitmap_type::sizeof_buffer(me.m_bmp.dimensions()));
-                    gfx::rgba_pixel<32> px;
-                    me.bg_next.blend(me.bg,me.bg_blend,&px);
-                    gfx::draw::filled_rectangle(me.m_bmp2,me.m_bmp2.bounds(),px);
-                }
-                me.m_current_bmp=&me.m_bmp2;
-            } else {
-                if(me.m_bmp3.begin()) {
-                    memcpy(me.m_bmp3.begin(),me.m_bmp.begin(),bitmap_type::sizeof_buffer(me.m_bmp.dimensions()));
-                    gfx::rgba_pixel<32> px;
-                    me.bg_next.blend(me.bg,me.bg_blend,&px);
-                    gfx::draw::filled_rectangle(me.m_bmp3,me.m_bmp3.bounds(),px);
-                }
-                me.m_current_bmp=&me.m_bmp3;
+            // sleep until the paint side asks for the next tint step,
+            // which is usually well before it's due
+            ulTaskNotifyTake(pdTRUE,portMAX_DELAY);
+            // the back frame is ours alone until m_bg_ready says it's done
+            const uint32_t step = me.m_bg_request.load(std::memory_order_acquire);
+            const size_t slot = 1-me.m_front;
+            const gfx::rgba_pixel<32> px = me.bg_tint(step);
+            const uint32_t start_us = frame_stats::now_us();
+            if(me.m_trace!=nullptr) {
+                me.m_trace->begin(trace_buffer::bg_task);
+            }
+            me.compose_background(me.m_frames[slot],px);
+            if(me.m_trace!=nullptr) {
+                me.m_trace->end(trace_buffer::bg_task);
+            }
+            if(me.m_stats!=nullptr) {
+                me.m_stats->add(frame_stats::bg_compose,start_us);
             }
-            vTaskDelay(1);
-            
+            me.m_frame_tints[slot] = px;
+            ++me.m_bg_produced;
+            // changed() swaps it to the front once the step is due. Until
+            // it asks for another step, this task doesn't touch the frames.
+            me.m_bg_ready.store(step,std::memory_order_release);
         }
     }
     void allocate() {
-        deallocate();
-        m_bmp = gfx::create_bitmap<pixel_type,palette_type>(gfx::size16(320,240),alloc,this->palette());
-        if(!m_bmp.begin()) {
-            m_bmp = bitmap_type({0,0},nullptr);
-            return;
+        // the source usually comes from preload(). Otherwise, or if that
+        // failed, load it here.
+        if(!wait_preload() || m_source==nullptr) {
+            deallocate();
+            if(!load_source()) {
+                return;
+            }
         }
-        m_bmp2 = gfx::create_bitmap<pixel_type,palette_type>(gfx::size16(320,240),alloc,this->palette());
-        if(!m_bmp2.begin()) {
+        m_scratch = (uint8_t*)alloc_internal(bitmap_type::sizeof_buffer(gfx::size16(320,scratch_lines)));
+        if(m_scratch==nullptr) {
             deallocate();
             return;
         }
-        m_bmp3 = gfx::create_bitmap<pixel_type,palette_type>(gfx::size16(320,240),alloc,this->palette());
-        if(!m_bmp3.begin()) {
+        if(!m_sprites.allocate(m_sprite_count,alloc) ||
+                !m_bins.allocate(m_sprite_count,this->dimensions().height,m_sprite_size+1,alloc) ||
+                !m_physics.allocate(m_sprite_count,this->dimensions().width,this->dimensions().height,bar_extent(),alloc)) {
             deallocate();
             return;
         }
+        if(!m_direct) {
+            for(size_t i = 0;i<frame_count;++i) {
+                m_frames[i] = gfx::create_bitmap<pixel_type,palette_type>(gfx::size16(bg_width,bg_height),alloc,this->palette());
+                if(!m_frames[i].begin()) {
+                    deallocate();
+                    return;
+                }
+                m_frame_tints[i].native_value = 0;
+            }
+        }
+        m_front = 0;
+        m_paint_tint.native_value = 0;
+        m_direct_tint = make_tint(m_paint_tint);
+        m_bg_produced = 0;
+        m_bg_consumed = 0;
+        m_bg_ready = no_step;
+        if(m_direct) {
+            if(m_render_scale==2 && !allocate_half()) {
+                m_render_scale = 1;
+            }
+            return;
+        }
+        memcpy(m_frames[m_front].begin(),m_source,bitmap_type::sizeof_buffer(gfx::size16(bg_width,bg_height)));
+        // start composing only once the source is fully decoded
         xTaskCreatePinnedToCore(bg_task,"bg_task",4096,this,24,&bg_task_handle,1-xTaskGetCoreID(xTaskGetCurrentTaskHandle()));
         if(bg_task_handle==nullptr) {
             deallocate();
             return;
         }
-        m_current_bmp = &m_bmp2;
-        m_bmp.fill(m_bmp.bounds(),pixel_type());
-        warhol_img.initialize();
-        gfx::size16 dim=warhol_img.dimensions();
-        gfx::draw::image(m_bmp,dim.bounds().center(m_bmp.bounds()),warhol_img);
-        memcpy(m_bmp2.begin(),m_bmp.begin(),bitmap_type::sizeof_buffer(m_bmp.dimensions()));
-        
     }
     void deallocate() {
+        wait_preload();
         if(bg_task_handle!=nullptr) {
             vTaskDelete(bg_task_handle);
             bg_task_handle = nullptr;
@@ -123,16 +298,229 @@ class warhol_box : public uix::control<ControlSurfaceType> {
             free(m_bmp.begin());
             m_bmp = bitmap_type({0,0},nullptr);
         }
-        if(m_bmp2.begin()) {
-            free(m_bmp2.begin());
-            m_bmp2 = bitmap_type({0,0},nullptr);
+        m_source = nullptr;
+        for(size_t i = 0;i<frame_count;++i) {
+            if(m_frames[i].begin()) {
+                free(m_frames[i].begin());
+                m_frames[i] = bitmap_type({0,0},nullptr);
+            }
+        }
+        if(m_scratch!=nullptr) {
+            free(m_scratch);
+            m_scratch = nullptr;
+        }
+        m_sprites.deallocate();
+        m_bins.deallocate();
+        m_physics.deallocate();
+        deallocate_half();
+    }
+    // the buffers half resolution needs, with the source scaled down into
+    // m_source_half. Only direct mode uses them.
+    bool allocate_half() {
+        if(m_half!=nullptr) {
+            return true;
+        }
+        const size_t size = bitmap_type::sizeof_buffer(gfx::size16(bg_width/2,bg_height/2));
+        m_half = (uint8_t*)alloc_internal(size);
+        m_source_half = (uint8_t*)alloc(size);
+        if(m_half==nullptr || m_source_half==nullptr ||
+                !m_half_bins.allocate(m_sprite_count,bg_height/2,m_sprite_size/2+2,alloc)) {
+            deallocate_half();
+            return false;
+        }
+        rgb565_downsample2x(m_source_half,bg_width,m_source,bg_width*2,bg_width/2,bg_height/2);
+        return true;
+    }
+    void deallocate_half() {
+        if(m_half!=nullptr) {
+            free(m_half);
+            m_half = nullptr;
+        }
+        if(m_source_half!=nullptr) {
+            free(m_source_half);
+            m_source_half = nullptr;
+        }
+        m_half_bins.deallocate();
+    }
+    static uint8_t blend_channel(int from, int to, int amount) {
+        return (uint8_t)(from+(((to-from)*amount+128)>>8));
+    }
+    // converts and premultiplies the bar colors once per frame
+    void update_bar_tints() {
+        for(size_t i = 0;i<m_sprites.size;++i) {
+            m_sprites.tints[i] = make_tint(blend_colors(m_sprites.colors[i],m_sprites.colors_next[i],m_sprites.blends[i]));
+        }
+    }
+    // draws m_active of the bars allocated. The ones coming back are
+    // colored and, unless the physics has them, posed for the current
+    // frame first. Either way the whole control repaints once.
+    void apply_active() {
+        sprite_list& s = m_sprites;
+        size_t size = m_active==0||m_active>s.capacity?s.capacity:m_active;
+        if(size==s.size) {
+            return;
+        }
+        if(size>s.size) {
+            const size_t first = s.size;
+            const size_t count = size-first;
+            if(!m_integrated) {
+                const int16_t bar = m_sprite_size;
+                sprite_pose(s.x0s+first,s.dxs+first,s.xs+first,nullptr,count,(bar/2)<<8,(this->bounds().x2-bar/2)<<8,(int64_t)m_anim_ticks-m_motion_origin);
+                sprite_pose(s.y0s+first,s.dys+first,s.ys+first,nullptr,count,(bar/2)<<8,(this->bounds().y2-bar/2)<<8,(int64_t)m_anim_ticks-m_motion_origin);
+            }
+            for(size_t i = first;i<size;++i) {
+                s.cxs[i] = (int16_t)((s.xs[i]+128)>>8);
+                s.cys[i] = (int16_t)((s.ys[i]+128)>>8);
+                s.colors[i] = bar_color(i,m_bar_phase);
+                s.colors_next[i] = bar_color(i,m_bar_phase+1);
+                s.blends[i] = m_tint_blend;
+                s.tints[i] = make_tint(blend_colors(s.colors[i],s.colors_next[i],s.blends[i]));
+                s.dirty[i] = bar_rect(i);
+            }
+        }
+        s.size = size;
+        m_repaint_all = true;
+        schedule_frame(millis());
+    }
+    // asks bg_task for the background of a tint step
+    void request_background(uint32_t step) {
+        m_bg_wanted = step;
+        // publishes m_front to bg_task along with the step
+        m_bg_request.store(step,std::memory_order_release);
+        if(bg_task_handle!=nullptr) {
+            xTaskNotifyGive(bg_task_handle);
+        }
+    }
+    constexpr static const uint32_t no_step = 0xFFFFFFFF;
+    // asks the clock for a frame at ms on the millis() clock
+    void schedule_frame(uint32_t ms) {
+        if(m_clock!=nullptr) {
+            m_clock->schedule_in(m_clock_client,(int32_t)(ms-millis()));
+        }
+    }
+    static uint32_t ticks_at(uint32_t ms) {
+        return (uint32_t)((uint64_t)ms*anim_fps*256/1000);
+    }
+    // what bar index shows in color step phase. Each bar starts on its
+    // own palette entry.
+    gfx::rgba_pixel<32> bar_color(size_t index, uint32_t phase) const {
+        const uint32_t h = sprite_hash(m_seed,(uint32_t)index*4+bar_color_lane,phase);
+        return select_color(phase==0?(uint32_t)index:h,h>>8);
+    }
+    // the background tint after step tint steps
+    gfx::rgba_pixel<32> bg_tint(uint32_t step) const {
+        const uint32_t total = step*blend_step;
+        const uint32_t phase = total/blend_one;
+        const gfx::rgba_pixel<32> from = select_color(sprite_hash(m_seed,bg_lane,phase),sprite_hash(m_seed,bg_lane,phase)>>8);
+        const gfx::rgba_pixel<32> to = select_color(sprite_hash(m_seed,bg_lane,phase+1),sprite_hash(m_seed,bg_lane,phase+1)>>8);
+        return blend_colors(from,to,(uint16_t)(total%blend_one));
+    }
+    // moves everything to ticks into the animation. Without collisions the
+    // bars are posed in closed form, so ticks can jump anywhere. With them
+    // the physics steps the bars from the last frame instead.
+    void advance(uint32_t ticks) {
+        const int16_t size = m_sprite_size;
+        const int32_t x_lo = (size/2)<<8, x_hi = (this->bounds().x2-size/2)<<8;
+        const int32_t y_lo = (size/2)<<8, y_hi = (this->bounds().y2-size/2)<<8;
+        sprite_list& s = m_sprites;
+        for (size_t i = 0; i < s.size; ++i) {
+            s.dirty[i] = bar_rect(i);
+        }
+        const uint32_t start_us = frame_stats::now_us();
+        if(m_collisions) {
+            if(!m_integrated) {
+                // hand the bars over with the way each one is heading now
+                sprite_pose(s.x0s,s.dxs,s.xs,s.dxs,s.size,x_lo,x_hi,(int64_t)ticks-m_motion_origin);
+                sprite_pose(s.y0s,s.dys,s.ys,s.dys,s.size,y_lo,y_hi,(int64_t)ticks-m_motion_origin);
+                m_integrated = true;
+                m_anim_ticks = ticks;
+            }
+            // clamp it so a stall doesn't teleport the bars through each other
+            const uint32_t elapsed = ticks-m_anim_ticks;
+            m_physics.step(s,bar_extent(),x_lo,x_hi,y_lo,y_hi,(int32_t)(elapsed>max_step_ticks?max_step_ticks:elapsed),true);
+        } else {
+            if(m_integrated) {
+                // pose from wherever the physics left the bars
+                memcpy(s.x0s,s.xs,s.size*sizeof(int32_t));
+                memcpy(s.y0s,s.ys,s.size*sizeof(int32_t));
+                m_motion_origin = m_anim_ticks;
+                m_integrated = false;
+            }
+            sprite_pose(s.x0s,s.dxs,s.xs,nullptr,s.size,x_lo,x_hi,(int64_t)ticks-m_motion_origin);
+            sprite_pose(s.y0s,s.dys,s.ys,nullptr,s.size,y_lo,y_hi,(int64_t)ticks-m_motion_origin);
         }
-        if(m_bmp3.begin()) {
-            free(m_bmp3.begin());
-            m_bmp3 = bitmap_type({0,0},nullptr);
+        if(m_stats!=nullptr) {
+            m_stats->add(frame_stats::physics,start_us);
         }
+        m_anim_ticks = ticks;
+        // every bar blends through its colors at the same rate
+        const uint32_t total = (uint32_t)(((uint64_t)ticks*blend_step)>>8);
+        const uint32_t phase = total/blend_one;
+        // with fewer blend bits the tints only need remaking every few frames
+        const uint16_t blend = (uint16_t)(total%blend_one)&(uint16_t)(0xFF<<(8-m_blend_bits));
+        const bool recolor = phase!=m_bar_phase;
+        for (size_t i = 0; i < s.size; ++i) {
+            s.cxs[i] = (int16_t)((s.xs[i]+128)>>8);
+            s.cys[i] = (int16_t)((s.ys[i]+128)>>8);
+            s.dirty[i] = merge(s.dirty[i],bar_rect(i));
+            if(recolor) {
+                s.colors[i] = bar_color(i,phase);
+                s.colors_next[i] = bar_color(i,phase+1);
+            }
+            s.blends[i] = blend;
+        }
+        m_bar_phase = phase;
+        if(recolor || blend!=m_tint_blend) {
+            update_bar_tints();
+            m_tint_blend = blend;
+        }
+        // only change the background every bg_frames nominal frames (times
+        // the stride) so most frames only repaint the bars
+        const uint32_t step = ticks/((uint32_t)(bg_frames*m_bg_stride)<<8)*m_bg_stride;
+        if(step!=m_bg_step) {
+            m_bg_step = step;
+            m_bg_tint = bg_tint(step);
+        }
+    }
+    // the bounds of what changed within each of max_changed horizontal
+    // bands, skipping bands where nothing did
+    size_t band_dirty(gfx::srect16* out) const {
+        const int16_t height = this->dimensions().height;
+        const int16_t band = (height+max_changed-1)/max_changed;
+        gfx::srect16 bands[max_changed];
+        bool used[max_changed] = {};
+        for(size_t i = 0;i<m_sprites.size;++i) {
+            const gfx::srect16& r = m_sprites.dirty[i];
+            const int16_t y1 = r.y1<0?0:r.y1, y2 = r.y2>=height?height-1:r.y2;
+            for(int16_t b = y1/band;b<=y2/band && y1<=y2;++b) {
+                const gfx::srect16 part(r.x1,y1>b*band?y1:b*band,r.x2,y2<b*band+band-1?y2:b*band+band-1);
+                bands[b] = used[b]?merge(bands[b],part):part;
+                used[b] = true;
+            }
+        }
+        size_t result = 0;
+        for(size_t b = 0;b<max_changed;++b) {
+            if(used[b]) {
+                out[result++] = bands[b];
+            }
+        }
+        return result;
+    }
+    // the side of a bar's rect, center line included
+    int16_t bar_extent() const {
+        return (m_sprite_size/2)*2+1;
+    }
+    gfx::srect16 bar_rect(size_t index) const {
+        return gfx::srect16(gfx::spoint16(m_sprites.cxs[index],m_sprites.cys[index]),m_sprite_size/2);
     }
-    gfx::rgba_pixel<32> select_color(int index) {
+    static gfx::srect16 merge(const gfx::srect16& lhs, const gfx::srect16& rhs) {
+        return gfx::srect16(lhs.x1<rhs.x1?lhs.x1:rhs.x1,
+                            lhs.y1<rhs.y1?lhs.y1:rhs.y1,
+                            lhs.x2>rhs.x2?lhs.x2:rhs.x2,
+                            lhs.y2>rhs.y2?lhs.y2:rhs.y2);
+    }
+    // a palette color by index, with an alpha from bits
+    static gfx::rgba_pixel<32> select_color(uint32_t index, uint32_t bits) {
         gfx::rgba_pixel<32> result;
         switch(index%7) {
             case 0:
@@ -157,14 +545,14 @@ class warhol_box : public uix::control<ControlSurfaceType> {
                 result = color32_t::purple;
                 break;
         }
-        result.template channel<gfx::channel_name::A>((random() % 180) + 32);
+        result.template channel<gfx::channel_name::A>((bits % 180) + 32);
         return result;
     }
    public:
     warhol_box(uix::invalidation_tracker &parent, const palette_type *palette = nullptr)
-        : base_type(parent, palette) ,draw_state(0),m_bmp({0,0},nullptr),m_bmp2({0,0},nullptr),m_bmp3({0,0},nullptr),m_current_bmp(nullptr),bg_task_handle(nullptr) {
+        : base_type(parent, palette) {
     }
-    warhol_box(warhol_box &&rhs) : m_bmp({0,0},nullptr) {
+    warhol_box(warhol_box &&rhs) {
         draw_state = 0;
         do_move_control(rhs);
     }
@@ -175,7 +563,7 @@ class warhol_box : public uix::control<ControlSurfaceType> {
         do_move_control(rhs);
         return *this;
     }
-    warhol_box(const warhol_box &rhs) : m_bmp({0,0},nullptr) {
+    warhol_box(const warhol_box &rhs) {
         draw_state = 0;
         do_copy_control(rhs);
     }
@@ -189,6 +577,434 @@ class warhol_box : public uix::control<ControlSurfaceType> {
        deallocate();
     }
    
+    // when enabled (the default) invalidate_changed() only invalidates the
+    // moving bars, and the whole control only when the background tint
+    // actually changes
+    bool dirty_tracking() const {
+        return m_dirty_tracking;
+    }
+    void dirty_tracking(bool value) {
+        m_dirty_tracking = value;
+    }
+    // when enabled (the default) changed() merges the dirty rects wherever
+    // one panel window is cheaper to send than several
+    bool coalesce() const {
+        return m_coalesce;
+    }
+    void coalesce(bool value) {
+        m_coalesce = value;
+    }
+    // integer equivalent of to.blend(from,amount/256.0)
+    static gfx::rgba_pixel<32> blend_colors(const gfx::rgba_pixel<32>& from, const gfx::rgba_pixel<32>& to, uint16_t amount) {
+        gfx::rgba_pixel<32> result;
+        result.template channel<gfx::channel_name::R>(blend_channel(from.template channel<gfx::channel_name::R>(),to.template channel<gfx::channel_name::R>(),amount));
+        result.template channel<gfx::channel_name::G>(blend_channel(from.template channel<gfx::channel_name::G>(),to.template channel<gfx::channel_name::G>(),amount));
+        result.template channel<gfx::channel_name::B>(blend_channel(from.template channel<gfx::channel_name::B>(),to.template channel<gfx::channel_name::B>(),amount));
+        result.template channel<gfx::channel_name::A>(blend_channel(from.template channel<gfx::channel_name::A>(),to.template channel<gfx::channel_name::A>(),amount));
+        return result;
+    }
+    // backgrounds bg_task has composed, and how many of those made it to
+    // the screen. Any difference is wasted work.
+    uint32_t backgrounds_produced() const {
+        return m_bg_produced;
+    }
+    uint32_t backgrounds_consumed() const {
+        return m_bg_consumed;
+    }
+    // the tint baked into the background on screen
+    gfx::rgba_pixel<32> background_tint() const {
+        return m_paint_tint;
+    }
+    // records stage timings into stats, or nothing if it's null. Set it
+    // before the control is first painted.
+    frame_stats* stats() const {
+        return m_stats;
+    }
+    void stats(frame_stats* value) {
+        m_stats = value;
+    }
+    // records paint and bg_task spans into trace, or nothing if it's null.
+    // Set it before the control is first painted.
+    trace_buffer* trace() const {
+        return m_trace;
+    }
+    void trace(trace_buffer* value) {
+        m_trace = value;
+    }
+    // records when the source is ready and when the box first allocates
+    // into boot, or nothing if it's null
+    boot_times* boot() const {
+        return m_boot;
+    }
+    void boot(boot_times* value) {
+        m_boot = value;
+    }
+    // starts decoding (or mapping) the background on the other core, so
+    // it overlaps whatever the caller does until the first paint, which
+    // then only waits for it to finish. Returns false if it couldn't start,
+    // in which case the first paint loads it as before.
+    bool preload() {
+        if(draw_state!=0 || m_preload_done!=nullptr || m_source!=nullptr) {
+            return false;
+        }
+        m_preload_done = xSemaphoreCreateBinary();
+        if(m_preload_done==nullptr) {
+            return false;
+        }
+        TaskHandle_t handle = nullptr;
+        xTaskCreatePinnedToCore(preload_task,"preload_task",4096,this,5,&handle,1-xTaskGetCoreID(xTaskGetCurrentTaskHandle()));
+        if(handle==nullptr) {
+            vSemaphoreDelete(m_preload_done);
+            m_preload_done = nullptr;
+            return false;
+        }
+        return true;
+    }
+    // how many bars there are (at least one) and how big, 3 of 60x60 by
+    // default. Set them before the control is first painted.
+    constexpr static const size_t default_sprites = 3;
+    constexpr static const int16_t default_sprite_size = 60;
+    size_t sprites() const {
+        return m_sprite_count;
+    }
+    void sprites(size_t value) {
+        if(draw_state==0) {
+            m_sprite_count = value<1?1:(value<sprite_bins::max_sprites?value:sprite_bins::max_sprites);
+        }
+    }
+    int16_t sprite_size() const {
+        return m_sprite_size;
+    }
+    void sprite_size(int16_t value) {
+        if(draw_state==0 && value>0 && value<120) {
+            m_sprite_size = value;
+        }
+    }
+    // whether the bars collide with each other as well as the edges. The
+    // collision pass is bounded by physics().budget_us() each frame.
+    bool collisions() const {
+        return m_collisions;
+    }
+    void collisions(bool value) {
+        m_collisions = value;
+    }
+    // how many of the bars are drawn and moved, from 1 up to sprites(), or
+    // 0 for all of them (the default). Bars that go come back where the
+    // animation has them by then.
+    size_t active_sprites() const {
+        return draw_state==0?m_active:m_sprites.size;
+    }
+    void active_sprites(size_t value) {
+        m_active = value;
+        if(draw_state!=0) {
+            apply_active();
+        }
+    }
+    // bits of precision in the bar color blend, 8 by default. With fewer,
+    // the bar tints are only remade when the rounded blend moves on.
+    uint8_t blend_bits() const {
+        return m_blend_bits;
+    }
+    void blend_bits(uint8_t value) {
+        m_blend_bits = value>8?8:value;
+    }
+    // background tint steps per repaint, 1 by default. Each repaint
+    // recomposes the whole control, so a stride of 2 or more trades tint
+    // smoothness for fewer of them. The tint still lands where it would
+    // have at full rate.
+    uint8_t bg_stride() const {
+        return m_bg_stride;
+    }
+    void bg_stride(uint8_t value) {
+        m_bg_stride = value<1?1:value;
+    }
+    // 2 composes direct mode frames at half resolution and pixel doubles
+    // them into the stripes, for about a quarter of the compose work (the
+    // bytes sent stay the same). 1, full resolution, is the default. It
+    // can be switched between any two frames. UIX mode ignores it, and it
+    // stays at 1 if the half size buffers can't be allocated.
+    uint8_t render_scale() const {
+        return m_render_scale;
+    }
+    void render_scale(uint8_t value) {
+        value = value==2?2:1;
+        if(value==m_render_scale) {
+            return;
+        }
+        if(draw_state!=0) {
+            if(!m_direct || (value==2 && !allocate_half())) {
+                return;
+            }
+            m_repaint_all = true;
+            schedule_frame(millis());
+        }
+        m_render_scale = value;
+    }
+    // the seed every bar position, delta and color comes from. Picked at
+    // random on the first paint unless it's set before then.
+    uint32_t seed() const {
+        return m_seed;
+    }
+    void seed(uint32_t value) {
+        if(draw_state==0) {
+            m_seed = value;
+            m_seed_set = true;
+        }
+    }
+    // how far into the animation it is, in milliseconds
+    uint32_t animation_ms() const {
+        return draw_state==0?0:(m_paused?m_paused_ms:millis())-m_anim_start_ms;
+    }
+    // jumps the animation to ms in. The next frame is posed straight there,
+    // without stepping through the frames in between (unless collisions
+    // are on, which only moves the colors and the background).
+    void seek(uint32_t ms) {
+        m_anim_start_ms = millis()-ms;
+        if(m_paused) {
+            // show where it landed, then go idle again
+            m_paused_ms = millis();
+            schedule_frame(millis());
+        }
+    }
+    // freezes the animation where it is. Nothing moves, so the control
+    // stops asking its clock for frames until it's resumed, and picks up
+    // from the same spot then.
+    bool paused() const {
+        return m_paused;
+    }
+    void paused(bool value) {
+        if(value==m_paused) {
+            return;
+        }
+        m_paused = value;
+        if(value) {
+            m_paused_ms = millis();
+        } else {
+            m_anim_start_ms += millis()-m_paused_ms;
+            schedule_frame(millis());
+        }
+    }
+    // the clock to tell when the next frame is due. The control adds
+    // itself as a client and is due straight away.
+    animation_clock* clock() const {
+        return m_clock;
+    }
+    void clock(animation_clock* value) {
+        m_clock = value;
+        m_clock_client = value==nullptr?animation_clock::no_client:value->add();
+    }
+    // the time, on the millis() clock, the next after_paint animates to
+    // instead of the time it runs. A frame pacer sets it to the next
+    // frame's deadline so motion steps evenly. It only applies once.
+    void frame_time(uint32_t ms) {
+        m_frame_ms = ms;
+        m_frame_ms_set = true;
+    }
+    // steps the bars and keeps their timing and collision counters
+    const sprite_physics& physics() const {
+        return m_physics;
+    }
+    sprite_physics& physics() {
+        return m_physics;
+    }
+    // direct mode composes the tinted background straight from the source
+    // image into whatever buffer render() is given, so it needs no full
+    // screen PSRAM frames. Set it before the control is first painted.
+    bool direct() const {
+        return m_direct;
+    }
+    void direct(bool value) {
+        if(draw_state==0) {
+            m_direct = value;
+        }
+    }
+    // the most rects changed() reports
+    constexpr static const size_t max_changed = changed_capacity;
+    // collects what changed since the last paint into out, in control
+    // coordinates, and returns how many rects it wrote: each bar's old and
+    // new position, or the whole control if the background tint moved on.
+    // With more bars than max_changed, it's the bounds of what changed in
+    // each of max_changed horizontal bands instead. Call once per frame
+    // before painting.
+    size_t changed(gfx::srect16* out) {
+        const gfx::srect16 all(0,0,this->dimensions().width-1,this->dimensions().height-1);
+        m_state_stale = true;
+        const bool repaint_all = m_repaint_all;
+        m_repaint_all = false;
+        if(draw_state==0) {
+            out[0] = all;
+            return 1;
+        }
+        if(m_direct) {
+            if(m_bg_tint.native_value!=m_paint_tint.native_value) {
+                m_paint_tint = m_bg_tint;
+                m_direct_tint = make_tint(m_paint_tint);
+                out[0] = all;
+                return 1;
+            }
+        } else if(m_bg_ready.load(std::memory_order_acquire)==m_bg_wanted && m_bg_wanted<=m_bg_step) {
+            // bg_task has the step composed and is idle until it's asked
+            // for another, so its back frame can be handed over from here,
+            // right when the step is due. The front frame stays put until
+            // then, so a partial paint always matches what's on screen.
+            m_front = 1-m_front;
+            ++m_bg_consumed;
+            // render the step after this one ahead, or catch up if this
+            // one was late
+            request_background(m_bg_wanted<m_bg_step?m_bg_step:m_bg_step+m_bg_stride);
+            const gfx::rgba_pixel<32>& tint = m_frame_tints[m_front];
+            if(tint.native_value!=m_paint_tint.native_value) {
+                m_paint_tint = tint;
+                out[0] = all;
+                return 1;
+            }
+        }
+        if(!m_dirty_tracking || repaint_all) {
+            out[0] = all;
+            return 1;
+        }
+        gfx::srect16 rects[max_changed];
+        size_t rects_size = 0;
+        if(m_sprites.size<=max_changed) {
+            for(size_t i = 0;i<m_sprites.size;++i) {
+                rects[rects_size++] = m_sprites.dirty[i];
+            }
+        } else {
+            rects_size = band_dirty(rects);
+        }
+        if(!m_coalesce) {
+            for(size_t i = 0;i<rects_size;++i) {
+                out[i] = rects[i];
+            }
+            return rects_size;
+        }
+        m_planner.clear();
+        for(size_t i = 0;i<rects_size;++i) {
+            m_planner.add(rects[i]);
+        }
+        m_planner.plan();
+        for(size_t i = 0;i<m_planner.size();++i) {
+            out[i] = m_planner[i];
+        }
+        return m_planner.size();
+    }
+    // invalidates whatever changed since the last paint. Call once per
+    // frame before updating the display.
+    void invalidate_changed() {
+        gfx::srect16 rects[max_changed];
+        const size_t rects_size = changed(rects);
+        for(size_t i = 0;i<rects_size;++i) {
+            this->invalidate(rects[i]);
+        }
+    }
+    // captures the frame changed() just picked out, binning the bars.
+    // The snapshot stays valid until the next one.
+    void snapshot(frame_state* out) {
+        out->background = m_direct?m_source:m_frames[m_front].begin();
+        out->tinted = m_direct;
+        out->background_tint = m_direct_tint;
+        out->scale = 1;
+        out->half = nullptr;
+        if(m_direct && m_render_scale==2) {
+            out->background = m_source_half;
+            out->scale = 2;
+            out->half = m_half;
+            // in the half scene's coordinates, like compose() works in
+            const gfx::srect16 bg_rect = background_bounds();
+            m_half_bins.clear();
+            for(size_t i = 0;i<m_sprites.size;++i) {
+                const gfx::srect16 r = bar_rect(i);
+                m_half_bins.add(gfx::srect16((r.x1-bg_rect.x1)>>1,(r.y1-bg_rect.y1)>>1,(r.x2-bg_rect.x1)>>1,(r.y2-bg_rect.y1)>>1),m_sprites.tints[i]);
+            }
+            m_half_bins.bin();
+            out->sprites = &m_half_bins;
+            return;
+        }
+        m_bins.clear();
+        for(size_t i = 0;i<m_sprites.size;++i) {
+            m_bins.add(bar_rect(i),m_sprites.tints[i]);
+        }
+        m_bins.bin();
+        out->sprites = &m_bins;
+    }
+    // at render scale 2, composes the half size scene under area, in
+    // control coordinates, into state.half. Call it for every area before
+    // render()ing any of them. Areas have to start on an even pixel
+    // and be an even number of pixels wide and tall. The areas render()
+    // is then given have to start on an even column and be an even
+    // number of pixels wide.
+    void compose(const frame_state& state, const gfx::srect16& area) const {
+        if(state.scale!=2) {
+            return;
+        }
+        const gfx::srect16 bg_rect = background_bounds();
+        const gfx::srect16 half((area.x1-bg_rect.x1)>>1,(area.y1-bg_rect.y1)>>1,(area.x2-bg_rect.x1)>>1,(area.y2-bg_rect.y1)>>1);
+        const size_t width = half.width();
+        const size_t stride = bg_width;
+        const size_t offset = half.y1*stride+half.x1*2;
+        uint8_t* row = state.half+offset;
+        const uint8_t* src = state.background+offset;
+        for(int16_t y = half.y1;y<=half.y2;++y) {
+            rgb565_blend(row,src,width,state.background_tint);
+            row+=stride;
+            src+=stride;
+        }
+        state.sprites->render(state.half+offset,stride,half);
+    }
+    // composes area, in control coordinates, into dst as packed rows of
+    // area.width() RGB565 pixels in panel byte order: the background rows,
+    // tinted on the fly in direct mode, then the bars blended over them.
+    // At render scale 2 it pixel doubles what compose() made instead.
+    void render(const frame_state& state, uint8_t* dst, const gfx::srect16& area) const {
+        const size_t width = area.width();
+        const size_t stride = width*2;
+        const gfx::srect16 bg_rect = background_bounds();
+        if(state.scale==2) {
+            // compose() already did the work: just double it up. Rows can
+            // start on either half of a square, for interlaced fields.
+            const uint8_t* src = state.half+((area.x1-bg_rect.x1)>>1)*2;
+            uint8_t* row = dst;
+            for(int16_t y = area.y1;y<=area.y2;++y) {
+                if(y>area.y1 && ((y-bg_rect.y1)&1)) {
+                    memcpy(row,row-stride,stride);
+                } else {
+                    rgb565_double_row(row,src+((y-bg_rect.y1)>>1)*bg_width,width/2);
+                }
+                row+=stride;
+            }
+            return;
+        }
+        const size_t bg_stride = bg_width*2;
+        const uint8_t* src = state.background+(area.y1-bg_rect.y1)*bg_stride+(area.x1-bg_rect.x1)*2;
+        uint8_t* row = dst;
+        for(int16_t y = area.y1;y<=area.y2;++y) {
+            if(state.tinted) {
+                rgb565_blend(row,src,width,state.background_tint);
+            } else {
+                memcpy(row,src,stride);
+            }
+            row+=stride;
+            src+=bg_stride;
+        }
+        state.sprites->render(dst,stride,area);
+    }
+    // the same, from the current state
+    void render(uint8_t* dst, const gfx::srect16& area) {
+        if(m_state_stale) {
+            snapshot(&m_state);
+            m_state_stale = false;
+        }
+        render(m_state,dst,area);
+    }
+    // where the background image sits, in control coordinates
+    gfx::srect16 background_bounds() const {
+        const gfx::srect16 all(0,0,this->dimensions().width-1,this->dimensions().height-1);
+        return gfx::srect16(0,0,bg_width-1,bg_height-1).center(all);
+    }
+    // true once the control has allocated and can render()
+    bool ready() const {
+        return draw_state!=0;
+    }
     virtual bool on_touch(size_t locations_size, const gfx::spoint16 *locations) {
         return true;
     }
@@ -196,83 +1012,118 @@ class warhol_box : public uix::control<ControlSurfaceType> {
         
     }
     virtual void on_before_paint() override {
+        const uint32_t start_us = frame_stats::now_us();
         randomSeed(millis());
         if(draw_state==0) {
             allocate();
-            if(m_bmp.begin()) {
-                bg_blend = 0;
-                bg = select_color(random());
-                bg_next = select_color(random());
-                size_t i;
-                for (i = 0; i < count; ++i) {
-                    cls_blend[i]=0;
-                    pts[i] = gfx::spoint16((random() % (this->dimensions().width - size)) + size / 2, (random() % (this->dimensions().height - size)) + size / 2);
-                    dts[i] = {0, 0};
-                    // random deltas. Retry on (dy=0)
-                    while (dts[i].x == 0) {
-                        dts[i].x = (random() % 5) - 2;
-                    }
-                    while (dts[i].y == 0) {
-                        dts[i].y = (random() % 5) - 2;
-                    }
-                    cls[i]=select_color(i);
-                    cls_next[i]=select_color(random());
+            if(m_source!=nullptr) {
+                if(!m_seed_set) {
+                    m_seed = (uint32_t)random();
+                }
+                const int16_t size = m_sprite_size;
+                sprite_list& s = m_sprites;
+                for (size_t i = 0; i < s.size; ++i) {
+                    const uint32_t lane = (uint32_t)i*4;
+                    s.blends[i]=0;
+                    s.cxs[i] = (int16_t)((sprite_hash(m_seed,lane+bar_x_lane,0) % (this->dimensions().width - size)) + size / 2);
+                    s.cys[i] = (int16_t)((sprite_hash(m_seed,lane+bar_y_lane,0) % (this->dimensions().height - size)) + size / 2);
+                    s.xs[i] = s.x0s[i] = s.cxs[i]<<8;
+                    s.ys[i] = s.y0s[i] = s.cys[i]<<8;
+                    // nonzero deltas from -2 to 2
+                    static const int32_t deltas[] = {-2,-1,1,2};
+                    const uint32_t h = sprite_hash(m_seed,lane+bar_delta_lane,0);
+                    s.dxs[i] = deltas[h&3];
+                    s.dys[i] = deltas[(h>>2)&3];
+                    s.colors[i]=bar_color(i,0);
+                    s.colors_next[i]=bar_color(i,1);
+                    s.dirty[i] = bar_rect(i);
                 }
+                update_bar_tints();
+                m_tint_blend = 0;
+                apply_active();
+                m_anim_start_ms = millis();
+                m_anim_ticks = 0;
+                m_motion_origin = 0;
+                m_integrated = false;
+                m_bar_phase = 0;
+                m_bg_step = 0;
+                m_bg_tint = bg_tint(0);
+                request_background(0);
                 draw_state = 1;
+                if(m_boot!=nullptr) {
+                    m_boot->mark(boot_times::allocate);
+                }
             }
         } 
-        
+        if(m_stats!=nullptr) {
+            m_stats->add(frame_stats::before_paint,start_us);
+        }
     }
     virtual void on_after_paint() {
+        const uint32_t start_us = frame_stats::now_us();
         switch (draw_state) {
             case 0:
                 break;
-            case 1:
-                for (size_t i = 0; i < count; ++i) {
-                    gfx::spoint16& pt = pts[i];
-                    gfx::spoint16& d = dts[i];
-                    // move the bar
-                    pt.x += d.x;
-                    pt.y += d.y;
-                    // if it is about to hit the edge, invert
-                    // the respective deltas
-                    if (pt.x + d.x + -size / 2 < 0 || pt.x + d.x + size / 2 > this->bounds().x2) {
-                        d.x = -d.x;
-                    }
-                    if (pt.y + d.y + -size / 2 < 0 || pt.y + d.y + size / 2 > this->bounds().y2) {
-                        d.y = -d.y;
-                    }
-                    cls_blend[i]+=.1;
-                    if(cls_blend[i]>=1.1) {
-                        cls[i]=cls_next[i];
-                        cls_next[i]=select_color(random());
-                        cls_blend[i]=0;
+            case 1: {
+                // wherever the clock says the animation is, however many
+                // frames were dropped on the way
+                const uint32_t now_ms = m_frame_ms_set?m_frame_ms:millis();
+                m_frame_ms_set = false;
+                if(m_paused) {
+                    // pose it where it paused, once. After that nothing
+                    // changes, so nothing's due until it's resumed.
+                    const uint32_t ticks = ticks_at((int32_t)(m_paused_ms-m_anim_start_ms)<0?0:m_paused_ms-m_anim_start_ms);
+                    if(ticks==m_anim_ticks) {
+                        if(m_clock!=nullptr) {
+                            m_clock->idle(m_clock_client);
+                        }
+                        break;
                     }
-                    bg_blend+=.1;
-                    if(bg_blend>=1.1) {
-                        bg = bg_next;
-                        bg_next = select_color(random());
-                        bg_blend = 0;
-                    }
-                
+                    advance(ticks);
+                    schedule_frame(millis());
+                    break;
                 }
-
+                advance(ticks_at((int32_t)(now_ms-m_anim_start_ms)<0?0:now_ms-m_anim_start_ms));
+                // the pose just made is for now_ms, so that's when the next
+                // frame should show it
+                schedule_frame(now_ms);
                 break;
+            }
+        }
+        if(m_stats!=nullptr) {
+            m_stats->add(frame_stats::after_paint,start_us);
         }
     }
     virtual void on_paint(control_surface_type &destination, const gfx::srect16 &clip) override {
-        gfx::srect16 sr=(gfx::srect16)m_current_bmp->bounds().center(destination.bounds());
-        sr=sr.crop(clip);
-        gfx::draw::bitmap(destination,sr,*m_current_bmp,(gfx::rect16)clip);
-        // draw the bars
-        for (size_t i = 0; i < count; ++i) {
-            gfx::spoint16& pt = pts[i];
-            gfx::srect16 r(pt,size/2);
-            if (clip.intersects(r)) {
-                gfx::rgba_pixel<32> col;
-                cls_next[i].blend(cls[i],cls_blend[i],&col);
-                gfx::draw::filled_rectangle(destination, r, col, &clip);
+        if(draw_state==0) {
+            return;
+        }
+        const gfx::srect16 bg_rect = background_bounds();
+        if(!clip.intersects(bg_rect)) {
+            return;
+        }
+        const gfx::srect16 area = clip.crop(bg_rect);
+        const uint32_t start_us = frame_stats::now_us();
+        if(m_trace!=nullptr) {
+            m_trace->begin(trace_buffer::paint);
+        }
+        // compose a few lines at a time in internal RAM with the packed
+        // RGB565 kernels, then hand each strip to UIX in one go
+        for(int16_t y = area.y1;y<=area.y2;y+=scratch_lines) {
+            int16_t y2 = y+scratch_lines-1;
+            if(y2>area.y2) {
+                y2 = area.y2;
             }
+            const gfx::srect16 strip(area.x1,y,area.x2,y2);
+            render(m_scratch,strip);
+            bitmap_type scratch(gfx::size16(strip.width(),strip.height()),m_scratch,this->palette());
+            gfx::draw::bitmap(destination,strip,scratch,scratch.bounds());
+        }
+        if(m_trace!=nullptr) {
+            m_trace->end(trace_buffer::paint);
+        }
+        if(m_stats!=nullptr) {
+            m_stats->add(frame_stats::paint,start_us);
         }
     }
 };
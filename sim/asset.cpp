@@ -0,0 +1,162 @@
+// host side asset tools: decodes the embedded JPEG, packs it as a raw or
+// LZ4 compressed RGB565 asset and writes that out as a header main.cpp
+// can embed instead (see WARHOL_ASSET_RAW and WARHOL_ASSET_LZ4), or as a
+// binary for the warhol partition (see WARHOL_ASSET_PARTITION)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <gfx.hpp>
+#include "rgb565_asset.hpp"
+#include "sim.hpp"
+
+// the simulator keeps its own copy of the JPEG so it can convert and
+// compare against it whichever format main.cpp embeds
+namespace {
+#define WARHOL320_IMPLEMENTATION
+#include "assets/warhol320.h"
+}  // namespace
+
+namespace sim {
+size_t jpeg_asset_size() {
+    return sizeof(warhol320);
+}
+bool decode_jpeg(uint8_t* dst) {
+    gfx::bitmap<gfx::rgb_pixel<16>> bmp(gfx::size16(panel_width, panel_height), dst);
+    bmp.fill(bmp.bounds(), gfx::rgb_pixel<16>());
+    // a fresh stream each time so every decode starts from the top
+    gfx::const_buffer_stream stm(warhol320, sizeof(warhol320));
+    gfx::jpg_image img(stm);
+    if (gfx::gfx_result::success != img.initialize()) {
+        return false;
+    }
+    const gfx::size16 dim = img.dimensions();
+    return gfx::gfx_result::success == gfx::draw::image(bmp, dim.bounds().center(bmp.bounds()), img);
+}
+// greedy single-probe LZ4 block compressor. It doesn't squeeze as hard
+// as the reference implementation, but its output is a valid block.
+static std::vector<uint8_t> lz4_compress(const uint8_t* src, size_t size) {
+    constexpr static const int hash_bits = 14;
+    constexpr static const size_t last_literals = 5;  // the format requires these
+    constexpr static const size_t match_margin = 12;  // and no match starting closer to the end
+    std::vector<uint8_t> out;
+    std::vector<int32_t> table((size_t)1 << hash_bits, -1);
+    auto write_length = [&out](size_t length) {
+        while (length >= 255) {
+            out.push_back(255);
+            length -= 255;
+        }
+        out.push_back((uint8_t)length);
+    };
+    auto write_sequence = [&](size_t anchor, size_t literals, size_t offset, size_t match) {
+        const size_t match_code = match == 0 ? 0 : match - 4;
+        out.push_back((uint8_t)(((literals < 15 ? literals : 15) << 4) | (match_code < 15 ? match_code : 15)));
+        if (literals >= 15) {
+            write_length(literals - 15);
+        }
+        out.insert(out.end(), src + anchor, src + anchor + literals);
+        if (match == 0) {
+            return;
+        }
+        out.push_back((uint8_t)offset);
+        out.push_back((uint8_t)(offset >> 8));
+        if (match_code >= 15) {
+            write_length(match_code - 15);
+        }
+    };
+    size_t anchor = 0, i = 0;
+    const size_t match_limit = size > match_margin ? size - match_margin : 0;
+    while (i < match_limit) {
+        uint32_t value;
+        memcpy(&value, src + i, 4);
+        const uint32_t hash = (value * 2654435761U) >> (32 - hash_bits);
+        const int32_t candidate = table[hash];
+        table[hash] = (int32_t)i;
+        if (candidate >= 0 && i - candidate <= 65535 && 0 == memcmp(src + candidate, src + i, 4)) {
+            size_t match = 4;
+            while (i + match < size - last_literals && src[candidate + match] == src[i + match]) {
+                ++match;
+            }
+            write_sequence(anchor, i - anchor, i - candidate, match);
+            i += match;
+            anchor = i;
+        } else {
+            ++i;
+        }
+    }
+    write_sequence(anchor, size - anchor, 0, 0);
+    return out;
+}
+std::vector<uint8_t> make_asset(const uint8_t* pixels, rgb565_asset_format format) {
+    const size_t size = (size_t)panel_width * panel_height * 2;
+    std::vector<uint8_t> payload = format == rgb565_asset_format::lz4 ? lz4_compress(pixels, size) : std::vector<uint8_t>(pixels, pixels + size);
+    std::vector<uint8_t> result(rgb565_asset_header_size + payload.size());
+    rgb565_asset_write_header(result.data(), panel_width, panel_height, format, (uint32_t)payload.size());
+    memcpy(result.data() + rgb565_asset_header_size, payload.data(), payload.size());
+    return result;
+}
+int export_asset(const char* format, const char* path) {
+    rgb565_asset_format fmt;
+    const char* name;
+    if (0 == strcmp(format, "raw")) {
+        fmt = rgb565_asset_format::raw;
+        name = "RAW";
+    } else if (0 == strcmp(format, "lz4")) {
+        fmt = rgb565_asset_format::lz4;
+        name = "LZ4";
+    } else {
+        printf("Unknown asset format %s\n", format);
+        return 1;
+    }
+    std::vector<uint8_t> pixels((size_t)panel_width * panel_height * 2);
+    if (!decode_jpeg(pixels.data())) {
+        puts("Unable to decode the JPEG");
+        return 1;
+    }
+    const std::vector<uint8_t> asset = make_asset(pixels.data(), fmt);
+    const size_t path_len = strlen(path);
+    if (path_len > 4 && 0 == strcmp(path + path_len - 4, ".bin")) {
+        FILE* file = fopen(path, "wb");
+        if (file == nullptr || asset.size() != fwrite(asset.data(), 1, asset.size(), file) || 0 != fclose(file)) {
+            printf("Unable to write %s\n", path);
+            return 1;
+        }
+        printf("wrote %s: %zu bytes (%s), %zu bytes of JPEG\n", path, asset.size(), format, jpeg_asset_size());
+        return 0;
+    }
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        printf("Unable to write %s\n", path);
+        return 1;
+    }
+    // same layout as the gfx converter's headers
+    fprintf(file,
+            "// Generated by the warhol simulator (--export-asset %s)\n"
+            "// --------------------------------------------------------\n"
+            "// Add #define WARHOL320_%s_IMPLEMENTATION\n"
+            "// to exactly one CPP file before including this file.\n"
+            "// --------------------------------------------------------\n"
+            "\n"
+            "#ifndef WARHOL320_%s_H\n"
+            "#define WARHOL320_%s_H\n"
+            "#include <stdint.h>\n"
+            "\n"
+            "extern const uint8_t warhol320_%s[];\n"
+            "#endif\n"
+            "\n"
+            "#ifdef WARHOL320_%s_IMPLEMENTATION\n"
+            "const uint8_t warhol320_%s[] = {\n",
+            format, name, name, name, format, name, format);
+    for (size_t i = 0; i < asset.size(); ++i) {
+        fprintf(file, "%s0x%02x%s", i % 16 == 0 ? "\t" : "", asset[i],
+                i + 1 == asset.size() ? "\n" : (i % 16 == 15 ? ",\n" : ","));
+    }
+    fputs("};\n\n#endif\n", file);
+    if (0 != fclose(file)) {
+        printf("Unable to write %s\n", path);
+        return 1;
+    }
+    printf("wrote %s: %zu bytes (%s), %zu bytes of JPEG\n", path, asset.size(), format, jpeg_asset_size());
+    return 0;
+}
+}  // namespace sim
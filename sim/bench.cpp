@@ -0,0 +1,966 @@
+// host micro-benchmarks for the rendering kernels
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <gfx.hpp>
+#include "rgb565.hpp"
+#include "ui.hpp"
+#include "flush_planner.hpp"
+#include "stripe_scheduler.hpp"
+#include "sprite_list.hpp"
+#include "sprite_physics.hpp"
+#include "sprite_motion.hpp"
+#include "quality_governor.hpp"
+#include "sim.hpp"
+
+namespace sim {
+using bitmap_t = gfx::bitmap<gfx::rgb_pixel<16>>;
+constexpr static const size_t screen_pixels = panel_width * panel_height;
+constexpr static const size_t screen_bytes = screen_pixels * 2;
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static void fill_noise(uint8_t* buffer, size_t size, uint32_t seed) {
+    for (size_t i = 0; i < size; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        buffer[i] = (uint8_t)(seed >> 24);
+    }
+}
+// largest per-channel difference between two big-endian RGB565 buffers
+static int max_lsb_error(const uint8_t* lhs, const uint8_t* rhs, size_t pixels) {
+    int result = 0;
+    for (size_t i = 0; i < pixels; ++i) {
+        const int l = (lhs[i * 2] << 8) | lhs[i * 2 + 1];
+        const int r = (rhs[i * 2] << 8) | rhs[i * 2 + 1];
+        const int d[3] = {abs((l >> 11) - (r >> 11)), abs(((l >> 5) & 63) - ((r >> 5) & 63)), abs((l & 31) - (r & 31))};
+        for (int c = 0; c < 3; ++c) {
+            if (d[c] > result) {
+                result = d[c];
+            }
+        }
+    }
+    return result;
+}
+static void report(const char* label, uint64_t ns, int iterations, size_t bytes_per_frame) {
+    const double frame_ns = (double)ns / iterations;
+    printf("  %-28s %8.3fms/frame %6.2fns/px %7zu bytes/frame %8.1fMB/s\n",
+           label, frame_ns / 1e6, frame_ns / screen_pixels, bytes_per_frame, bytes_per_frame / frame_ns * 1e3);
+}
+
+// background compose: copy the source image and tint it
+static int bench_tint() {
+    constexpr static const int iterations = 200;
+    uint8_t* src = (uint8_t*)malloc(screen_bytes);
+    uint8_t* dst = (uint8_t*)malloc(screen_bytes);
+    uint8_t* ref = (uint8_t*)malloc(screen_bytes);
+    if (src == nullptr || dst == nullptr || ref == nullptr) {
+        puts("Out of memory");
+        return 1;
+    }
+    fill_noise(src, screen_bytes, 1);
+    bitmap_t dst_bmp(gfx::size16(panel_width, panel_height), dst);
+    gfx::rgba_pixel<32> px(255, 165, 0, 120);
+    const rgb565_tint tint = rgb565_make_tint(255, 165, 0, 120);
+    printf("tint: %dx%d RGB565, %d iterations\n", panel_width, panel_height, iterations);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; ++i) {
+        memcpy(dst, src, screen_bytes);
+        gfx::draw::filled_rectangle(dst_bmp, dst_bmp.bounds(), px);
+    }
+    report("memcpy + gfx alpha fill", now_ns() - start, iterations, screen_bytes * 4);
+    memcpy(ref, dst, screen_bytes);
+
+    start = now_ns();
+    for (int i = 0; i < iterations; ++i) {
+        memcpy(dst, src, screen_bytes);
+        rgb565_blend(dst, dst, screen_pixels, tint);
+    }
+    report("memcpy + SWAR blend", now_ns() - start, iterations, screen_bytes * 4);
+
+    start = now_ns();
+    for (int i = 0; i < iterations; ++i) {
+        rgb565_blend(dst, src, screen_pixels, tint);
+    }
+    report("fused SWAR copy+blend", now_ns() - start, iterations, screen_bytes * 2);
+    printf("  max error vs gfx: %d LSB\n", max_lsb_error(ref, dst, screen_pixels));
+    free(src);
+    free(dst);
+    free(ref);
+    return 0;
+}
+
+// translucent constant-color rect fills, the way the bars are drawn
+static int bench_fill() {
+    constexpr static const int iterations = 2000;
+    constexpr static const int size = 61;
+    uint8_t* buffer = (uint8_t*)malloc(screen_bytes);
+    uint8_t* ref = (uint8_t*)malloc(screen_bytes);
+    if (buffer == nullptr || ref == nullptr) {
+        puts("Out of memory");
+        return 1;
+    }
+    bitmap_t bmp(gfx::size16(panel_width, panel_height), buffer);
+    const gfx::rgba_pixel<32> px(0, 255, 255, 140);
+    const gfx::srect16 r(97, 51, 97 + size - 1, 51 + size - 1);
+    const size_t pixels = (size_t)iterations * size * size;
+    printf("fill: %dx%d translucent rect, %d iterations\n", size, size, iterations);
+    // one blend of each over the same noise for the error check
+    fill_noise(ref, screen_bytes, 3);
+    bitmap_t ref_bmp(gfx::size16(panel_width, panel_height), ref);
+    gfx::draw::filled_rectangle(ref_bmp, r, px);
+    fill_noise(buffer, screen_bytes, 3);
+    rgb565_fill_blend(buffer + (r.y1 * panel_width + r.x1) * 2, panel_width * 2, size, size, rgb565_make_tint(0, 255, 255, 140));
+    const int error = max_lsb_error(ref, buffer, screen_pixels);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; ++i) {
+        gfx::draw::filled_rectangle(bmp, r, px);
+    }
+    uint64_t generic_ns = now_ns() - start;
+    start = now_ns();
+    for (int i = 0; i < iterations; ++i) {
+        // includes converting and premultiplying the color, once per rect
+        const rgb565_tint tint = rgb565_make_tint(0, 255, 255, 140);
+        rgb565_fill_blend(buffer + (r.y1 * panel_width + r.x1) * 2, panel_width * 2, size, size, tint);
+    }
+    uint64_t fast_ns = now_ns() - start;
+    printf("  gfx filled_rectangle  %6.2fns/px\n", (double)generic_ns / pixels);
+    printf("  rgb565_fill_blend     %6.2fns/px (%.1fx)\n", (double)fast_ns / pixels, (double)generic_ns / fast_ns);
+    printf("  max error vs gfx: %d LSB\n", error);
+    free(buffer);
+    free(ref);
+    return 0;
+}
+
+// fixed-point animation colors against the float gfx blend they replace,
+// compared as the RGB565 pixels that end up on screen
+static int bench_blend() {
+    constexpr static const int pairs = 2000;
+    constexpr static const size_t row = 64;
+    uint8_t src[row * 2];
+    uint8_t ref[row * 2];
+    uint8_t out[row * 2];
+    bitmap_t ref_bmp(gfx::size16(row, 1), ref);
+    fill_noise(src, sizeof(src), 7);
+    uint32_t seed = 11;
+    int worst = 0;
+    uint64_t float_ns = 0, fixed_ns = 0;
+    volatile uint32_t sink = 0;
+    for (int i = 0; i < pairs; ++i) {
+        uint8_t c[8];
+        fill_noise(c, sizeof(c), seed++);
+        const gfx::rgba_pixel<32> from(c[0], c[1], c[2], c[3]);
+        const gfx::rgba_pixel<32> to(c[4], c[5], c[6], c[7]);
+        uint64_t start = now_ns();
+        for (int amount = 0; amount <= 256; ++amount) {
+            gfx::rgba_pixel<32> reference;
+            to.blend(from, amount / 256.0, &reference);
+            sink = sink + reference.native_value;
+        }
+        float_ns += now_ns() - start;
+        start = now_ns();
+        for (int amount = 0; amount <= 256; ++amount) {
+            sink = sink + warhol_box_t::blend_colors(from, to, amount).native_value;
+        }
+        fixed_ns += now_ns() - start;
+        for (int amount = 0; amount <= 256; ++amount) {
+            gfx::rgba_pixel<32> reference;
+            to.blend(from, amount / 256.0, &reference);
+            const gfx::rgba_pixel<32> fixed = warhol_box_t::blend_colors(from, to, amount);
+            memcpy(ref, src, sizeof(src));
+            gfx::draw::filled_rectangle(ref_bmp, ref_bmp.bounds(), reference);
+            rgb565_blend(out, src, row, rgb565_make_tint(fixed.template channel<gfx::channel_name::R>(),
+                                                           fixed.template channel<gfx::channel_name::G>(),
+                                                           fixed.template channel<gfx::channel_name::B>(),
+                                                           fixed.template channel<gfx::channel_name::A>()));
+            const int error = max_lsb_error(ref, out, row);
+            if (error > worst) {
+                worst = error;
+            }
+        }
+    }
+    const int blends = pairs * 257;
+    printf("blend: %d color pairs x 257 amounts\n", pairs);
+    printf("  float gfx blend   %6.2fns/color\n", (double)float_ns / blends);
+    printf("  8.8 integer blend %6.2fns/color\n", (double)fixed_ns / blends);
+    printf("  max error vs float reference: %d LSB (%s)\n", worst, worst <= 1 ? "ok" : "FAILED");
+    return worst <= 1 ? 0 : 1;
+}
+
+// flush planner over random dirty rect sets: checks every dirty pixel is
+// still sent and that the plan never costs more than sending them as is
+static int bench_planner() {
+    constexpr static const int sets = 20000;
+    constexpr static const size_t max_rects = 8;
+    static uint8_t mask[screen_pixels];
+    flush_planner<max_rects> planner;
+    uint32_t seed = 5;
+    auto next = [&seed](int range) {
+        seed = seed * 1664525 + 1013904223;
+        return (int)((seed >> 8) % range);
+    };
+    uint64_t in_windows = 0, in_bytes = 0, out_windows = 0, out_bytes = 0, plan_ns = 0;
+    int failures = 0;
+    for (int i = 0; i < sets; ++i) {
+        const size_t rects_size = 1 + next(max_rects);
+        gfx::srect16 rects[max_rects];
+        planner.clear();
+        memset(mask, 0, sizeof(mask));
+        for (size_t j = 0; j < rects_size; ++j) {
+            // mostly bar sized rects, sometimes thin or large ones
+            const int w = 1 + (next(4) == 0 ? next(panel_width) : next(64));
+            const int h = 1 + (next(4) == 0 ? next(panel_height) : next(64));
+            const int x = next(panel_width - w + 1), y = next(panel_height - h + 1);
+            rects[j] = gfx::srect16(x, y, x + w - 1, y + h - 1);
+            planner.add(rects[j]);
+            in_bytes += planner.cost(rects[j]);
+            for (int yy = rects[j].y1; yy <= rects[j].y2; ++yy) {
+                memset(mask + yy * panel_width + rects[j].x1, 1, w);
+            }
+        }
+        in_windows += rects_size;
+        const uint64_t start = now_ns();
+        planner.plan();
+        plan_ns += now_ns() - start;
+        out_windows += planner.size();
+        out_bytes += planner.total_cost();
+        size_t naive = 0;
+        for (size_t j = 0; j < rects_size; ++j) {
+            naive += planner.cost(rects[j]);
+        }
+        for (size_t j = 0; j < planner.size(); ++j) {
+            const gfx::srect16& r = planner[j];
+            for (int yy = r.y1; yy <= r.y2; ++yy) {
+                memset(mask + yy * panel_width + r.x1, 0, r.width());
+            }
+        }
+        bool covered = true;
+        for (size_t j = 0; j < screen_pixels; ++j) {
+            if (mask[j] != 0) {
+                covered = false;
+                break;
+            }
+        }
+        if (!covered || planner.total_cost() > naive) {
+            ++failures;
+        }
+    }
+    printf("planner: %d random sets of 1-%d rects, %zu bytes per window\n", sets, (int)max_rects, planner.window_cost());
+    printf("  as is     %6.2f windows/set %9.1f bytes/set\n", (double)in_windows / sets, (double)in_bytes / sets);
+    printf("  planned   %6.2f windows/set %9.1f bytes/set %8.1fns/plan\n",
+           (double)out_windows / sets, (double)out_bytes / sets, (double)plan_ns / sets);
+    printf("  %d sets lost pixels or cost more (%s)\n", failures, failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+// shares random frames of stripes with uneven costs between workers, the
+// way the direct renderer does. The balance is measured on simulated
+// workers that each take their next stripe when their own clock is the
+// earliest, so it doesn't depend on how many cores the host has, and is
+// compared with a plain even split. Then real threads hammer the
+// scheduler to check every stripe is rendered exactly once.
+static int bench_stripes() {
+    constexpr static const int frames = 2000;
+    constexpr static const size_t workers = 4;
+    constexpr static const size_t max_stripes = 96;
+    stripe_scheduler<workers> scheduler;
+    std::atomic<uint32_t> claims[max_stripes];
+    uint32_t costs[max_stripes];
+    uint32_t seed = 7;
+    auto next = [&seed](int range) {
+        seed = seed * 1664525 + 1013904223;
+        return (int)((seed >> 8) % range);
+    };
+    auto make_frame = [&]() {
+        const size_t count = 1 + next(max_stripes);
+        for (size_t i = 0; i < count; ++i) {
+            claims[i] = 0;
+            // mostly bar sized stripes, sometimes a full width one that
+            // costs far more
+            costs[i] = next(8) == 0 ? 20000 : 500 + next(1000);
+        }
+        return count;
+    };
+    int failures = 0;
+    printf("stripes: %d random frames of 1-%d stripes, frame time relative to one worker\n", frames, (int)max_stripes);
+    printf("  %-8s %8s %8s %8s %8s\n", "workers", "even", "stealing", "ideal", "stolen");
+    for (size_t n = 1; n <= workers; ++n) {
+        uint64_t even = 0, stealing = 0, ideal = 0, total = 0, stripes = 0;
+        scheduler.reset_stolen();
+        for (int f = 0; f < frames; ++f) {
+            const size_t count = make_frame();
+            uint64_t sum = 0, largest = 0;
+            for (size_t i = 0; i < count; ++i) {
+                sum += costs[i];
+                largest = costs[i] > largest ? costs[i] : largest;
+            }
+            // an even split with no stealing finishes with its slowest share
+            uint64_t slowest = 0;
+            for (size_t w = 0; w < n; ++w) {
+                uint64_t share = 0;
+                for (size_t i = count * w / n; i < count * (w + 1) / n; ++i) {
+                    share += costs[i];
+                }
+                slowest = share > slowest ? share : slowest;
+            }
+            // stealing: whichever worker is free first claims next
+            uint64_t clocks[workers] = {};
+            bool done[workers] = {};
+            scheduler.start(count, n);
+            size_t finished = 0;
+            while (finished < n) {
+                size_t w = workers;
+                for (size_t i = 0; i < n; ++i) {
+                    if (!done[i] && (w == workers || clocks[i] < clocks[w])) {
+                        w = i;
+                    }
+                }
+                size_t index;
+                if (scheduler.next(w, &index)) {
+                    ++claims[index];
+                    clocks[w] += costs[index];
+                } else {
+                    done[w] = true;
+                    ++finished;
+                }
+            }
+            uint64_t makespan = 0;
+            for (size_t i = 0; i < n; ++i) {
+                makespan = clocks[i] > makespan ? clocks[i] : makespan;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (claims[i] != 1) {
+                    ++failures;
+                }
+            }
+            even += slowest;
+            stealing += makespan;
+            ideal += (sum + n - 1) / n > largest ? (sum + n - 1) / n : largest;
+            total += sum;
+            stripes += count;
+        }
+        printf("  %-8zu %8.3f %8.3f %8.3f %7.1f%%\n", n, (double)even / total, (double)stealing / total,
+               (double)ideal / total, 100.0 * scheduler.stolen() / stripes);
+    }
+    // the same on real threads, for races
+    for (int f = 0; f < frames; ++f) {
+        const size_t count = make_frame();
+        scheduler.start(count, workers);
+        auto run = [&](size_t worker) {
+            size_t index;
+            while (scheduler.next(worker, &index)) {
+                claims[index].fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+        std::thread threads[workers];
+        for (size_t w = 1; w < workers; ++w) {
+            threads[w] = std::thread(run, w);
+        }
+        run(0);
+        for (size_t w = 1; w < workers; ++w) {
+            threads[w].join();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (claims[i] != 1) {
+                ++failures;
+            }
+        }
+    }
+    printf("  %d stripes rendered other than once (%s)\n", failures, failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+static void* bench_alloc(size_t size) {
+    return malloc(size);
+}
+// composes a screen of random translucent sprites in 8 line stripes, the
+// old way (every sprite tested against every stripe) and binned, over a
+// range of sprite counts. Binned should track the pixels covered, not
+// sprites x stripes. Fails if the two differ anywhere.
+static int bench_sprites() {
+    constexpr static const int16_t stripe_lines = 8;
+    constexpr static const int16_t size = 16;
+    static const size_t counts[] = {3, 10, 30, 100, 300, 1000, 3000, 5000};
+    uint8_t* naive = (uint8_t*)malloc(screen_bytes);
+    uint8_t* binned = (uint8_t*)malloc(screen_bytes);
+    gfx::srect16* rects = (gfx::srect16*)malloc(5000 * sizeof(gfx::srect16));
+    rgb565_tint* tints = (rgb565_tint*)malloc(5000 * sizeof(rgb565_tint));
+    sprite_bins bins;
+    if (naive == nullptr || binned == nullptr || rects == nullptr || tints == nullptr ||
+        !bins.allocate(5000, panel_height, size, bench_alloc)) {
+        puts("Out of memory");
+        return 1;
+    }
+    uint32_t seed = 11;
+    auto next = [&seed](int range) {
+        seed = seed * 1664525 + 1013904223;
+        return (int)((seed >> 8) % range);
+    };
+    int failures = 0;
+    printf("sprites: %dx%d translucent sprites composed in %d line stripes\n", size, size, stripe_lines);
+    printf("  %-7s %9s %11s %11s %10s %10s %10s %11s %11s %11s\n", "sprites", "pixels", "naive tests", "binned tests",
+           "naive us", "binned us", "blend us", "naive ns/px", "binned ns/px", "blend ns/px");
+    for (size_t count : counts) {
+        uint64_t pixels = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const int x = next(panel_width - size + 1), y = next(panel_height - size + 1);
+            rects[i] = gfx::srect16(x, y, x + size - 1, y + size - 1);
+            tints[i] = rgb565_make_tint(next(256), next(256), next(256), 32 + next(180));
+            pixels += size * size;
+        }
+        const int iterations = count < 300 ? 400 : (count < 3000 ? 40 : 20);
+        uint64_t start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            for (int16_t y = 0; y < panel_height; y += stripe_lines) {
+                const gfx::srect16 area(0, y, panel_width - 1, y + stripe_lines - 1);
+                uint8_t* dst = naive + y * panel_width * 2;
+                memset(dst, 0, panel_width * 2 * stripe_lines);
+                for (size_t i = 0; i < count; ++i) {
+                    if (area.intersects(rects[i])) {
+                        const gfx::srect16 cr = rects[i].crop(area);
+                        rgb565_fill_blend(dst + (cr.y1 - area.y1) * panel_width * 2 + cr.x1 * 2, panel_width * 2, cr.width(), cr.height(), tints[i]);
+                    }
+                }
+            }
+        }
+        const uint64_t naive_ns = (now_ns() - start) / iterations;
+        start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            // binning is part of every frame
+            bins.clear();
+            for (size_t i = 0; i < count; ++i) {
+                bins.add(rects[i], tints[i]);
+            }
+            bins.bin();
+            for (int16_t y = 0; y < panel_height; y += stripe_lines) {
+                const gfx::srect16 area(0, y, panel_width - 1, y + stripe_lines - 1);
+                uint8_t* dst = binned + y * panel_width * 2;
+                memset(dst, 0, panel_width * 2 * stripe_lines);
+                bins.render(dst, panel_width * 2, area);
+            }
+        }
+        const uint64_t binned_ns = (now_ns() - start) / iterations;
+        if (0 != memcmp(naive, binned, screen_bytes)) {
+            ++failures;
+        }
+        // the floor either way: clearing the screen and blending every
+        // sprite whole, with no stripes to find them for
+        start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            memset(naive, 0, screen_bytes);
+            for (size_t i = 0; i < count; ++i) {
+                const gfx::srect16& r = rects[i];
+                rgb565_fill_blend(naive + r.y1 * panel_width * 2 + r.x1 * 2, panel_width * 2, r.width(), r.height(), tints[i]);
+            }
+        }
+        const uint64_t blend_ns = (now_ns() - start) / iterations;
+        printf("  %-7zu %9llu %11zu %11zu %10.1f %10.1f %10.1f %11.2f %11.2f %11.2f\n", count, (unsigned long long)pixels,
+               count * (panel_height / stripe_lines), bins.items(), naive_ns / 1000.0, binned_ns / 1000.0,
+               blend_ns / 1000.0, (double)naive_ns / pixels, (double)binned_ns / pixels, (double)blend_ns / pixels);
+    }
+    printf("  %d sprite counts where binned differs from naive (%s)\n", failures, failures == 0 ? "ok" : "FAILED");
+    free(naive);
+    free(binned);
+    free(rects);
+    free(tints);
+    return failures == 0 ? 0 : 1;
+}
+
+// a whole tinted screen with 60x60 bars through warhol_box's direct
+// renderer: render() at full resolution in 40 line stripes, against
+// compose() at half resolution and render() at scale 2 doubling it into
+// the same stripes. Fails if the doubling differs from the naive one, and
+// reports how far half resolution strays from full.
+static int bench_scale() {
+    constexpr static const int16_t stripe_lines = 40;
+    constexpr static const int16_t size = 60;
+    constexpr static const size_t half_width = panel_width / 2, half_height = panel_height / 2;
+    static const size_t counts[] = {3, 30, 300};
+    uint8_t* background = (uint8_t*)malloc(screen_bytes);
+    uint8_t* background_half = (uint8_t*)malloc(screen_bytes / 4);
+    uint8_t* half = (uint8_t*)malloc(screen_bytes / 4);
+    uint8_t* full = (uint8_t*)malloc(screen_bytes);
+    uint8_t* doubled = (uint8_t*)malloc(screen_bytes);
+    gfx::srect16* rects = (gfx::srect16*)malloc(300 * sizeof(gfx::srect16));
+    rgb565_tint* tints = (rgb565_tint*)malloc(300 * sizeof(rgb565_tint));
+    sprite_bins bins, half_bins;
+    if (background == nullptr || background_half == nullptr || half == nullptr || full == nullptr || doubled == nullptr ||
+        rects == nullptr || tints == nullptr || !bins.allocate(300, panel_height, size + 1, bench_alloc) ||
+        !half_bins.allocate(300, half_height, size / 2 + 2, bench_alloc)) {
+        puts("Out of memory");
+        return 1;
+    }
+    if (!decode_jpeg(background)) {
+        puts("Unable to decode the JPEG");
+        return 1;
+    }
+    rgb565_downsample2x(background_half, panel_width, background, panel_width * 2, half_width, half_height);
+    const rgb565_tint tint = rgb565_make_tint(255, 128, 0, 96);
+    // render() and compose() only need the box's bounds and the state
+    screen_t screen;
+    screen.dimensions({panel_width, panel_height});
+    warhol_box_t box(screen);
+    box.bounds(screen.bounds());
+    const warhol_box_t::frame_state full_state = {background, true, tint, &bins, 1, nullptr};
+    const warhol_box_t::frame_state half_state = {background_half, true, tint, &half_bins, 2, half};
+    uint32_t seed = 5;
+    auto next = [&seed](int range) {
+        seed = seed * 1664525 + 1013904223;
+        return (int)((seed >> 8) % range);
+    };
+    int failures = 0;
+    printf("scale: tinted %dx%d screen with %dx%d bars in %d line stripes\n", panel_width, panel_height, size, size,
+           stripe_lines);
+    printf("  %-7s %11s %11s %8s %14s\n", "bars", "full us", "half us", "speedup", "mean error");
+    for (size_t count : counts) {
+        for (size_t i = 0; i < count; ++i) {
+            const int x = next(panel_width - size + 1) & ~1, y = next(panel_height - size + 1) & ~1;
+            rects[i] = gfx::srect16(x, y, x + size - 1, y + size - 1);
+            tints[i] = rgb565_make_tint(next(256), next(256), next(256), 32 + next(180));
+        }
+        constexpr static const int iterations = 200;
+        uint64_t start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            bins.clear();
+            for (size_t i = 0; i < count; ++i) {
+                bins.add(rects[i], tints[i]);
+            }
+            bins.bin();
+            for (int16_t y = 0; y < panel_height; y += stripe_lines) {
+                box.render(full_state, full + y * panel_width * 2,
+                           gfx::srect16(0, y, panel_width - 1, y + stripe_lines - 1));
+            }
+        }
+        const uint64_t full_ns = (now_ns() - start) / iterations;
+        start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            half_bins.clear();
+            for (size_t i = 0; i < count; ++i) {
+                const gfx::srect16& r = rects[i];
+                half_bins.add(gfx::srect16(r.x1 >> 1, r.y1 >> 1, r.x2 >> 1, r.y2 >> 1), tints[i]);
+            }
+            half_bins.bin();
+            box.compose(half_state, screen.bounds());
+            for (int16_t y = 0; y < panel_height; y += stripe_lines) {
+                box.render(half_state, doubled + y * panel_width * 2,
+                           gfx::srect16(0, y, panel_width - 1, y + stripe_lines - 1));
+            }
+        }
+        const uint64_t half_ns = (now_ns() - start) / iterations;
+        const uint16_t* h = (const uint16_t*)half;
+        const uint16_t* d = (const uint16_t*)doubled;
+        const uint16_t* f = (const uint16_t*)full;
+        bool same = true;
+        uint64_t error = 0;
+        for (size_t y = 0; y < (size_t)panel_height; ++y) {
+            for (size_t x = 0; x < (size_t)panel_width; ++x) {
+                const uint16_t px = d[y * panel_width + x];
+                same = same && px == h[(y / 2) * half_width + x / 2];
+                const uint16_t a = rgb565_swap(px), b = rgb565_swap(f[y * panel_width + x]);
+                error += abs((a >> 11) - (b >> 11)) + abs(((a >> 5) & 0x3F) - ((b >> 5) & 0x3F)) / 2 +
+                         abs((a & 0x1F) - (b & 0x1F));
+            }
+        }
+        if (!same) {
+            ++failures;
+        }
+        printf("  %-7zu %11.1f %11.1f %7.2fx %8.2f LSB/ch%s\n", count, full_ns / 1000.0, half_ns / 1000.0,
+               (double)full_ns / half_ns, (double)error / screen_pixels / 3, same ? "" : " (FAILED: bad doubling)");
+    }
+    printf("  %d bar counts where the doubling is wrong (%s)\n", failures, failures == 0 ? "ok" : "FAILED");
+    free(background);
+    free(background_half);
+    free(half);
+    free(full);
+    free(doubled);
+    free(rects);
+    free(tints);
+    return failures == 0 ? 0 : 1;
+}
+// the bar physics over a range of sprite counts: the vector bounce step
+// against the scalar one it replaced, and the grid's overlap search
+// against testing every pair, then whole collision steps against the
+// default budget. Fails if the vector step drifts from the scalar one,
+// the grid misses or invents an overlap, or a step runs over budget.
+static int bench_physics() {
+    constexpr static const int16_t size = 8;
+    constexpr static const int16_t extent = (size / 2) * 2 + 1;
+    constexpr static const int32_t x_lo = (size / 2) << 8, x_hi = (panel_width - 1 - size / 2) << 8;
+    constexpr static const int32_t y_lo = (size / 2) << 8, y_hi = (panel_height - 1 - size / 2) << 8;
+    constexpr static const int32_t ticks = 256;
+    static const size_t counts[] = {100, 300, 1000, 3000, 5000};
+    sprite_list vector_list, scalar_list;
+    sprite_physics physics;
+    if (!vector_list.allocate(5000, bench_alloc) || !scalar_list.allocate(5000, bench_alloc) ||
+        !physics.allocate(5000, panel_width, panel_height, extent, bench_alloc)) {
+        puts("Out of memory");
+        return 1;
+    }
+    int failures = 0;
+    int over_budget = 0;
+    printf("physics: %dx%d bars over %dx%d, %uus budget\n", size, size, (int)panel_width, (int)panel_height,
+           (unsigned)physics.budget_us());
+    printf("  %-7s %10s %10s %10s %10s %8s %10s %10s %6s\n", "bars", "scalar ns", "vector ns", "all pairs",
+           "grid us", "overlaps", "step us", "contacts", "over");
+    for (size_t count : counts) {
+        srand((unsigned)count);
+        vector_list.size = count;
+        scalar_list.size = count;
+        for (size_t i = 0; i < count; ++i) {
+            vector_list.xs[i] = (int32_t)((x_lo >> 8) + rand() % ((x_hi - x_lo) >> 8)) << 8;
+            vector_list.ys[i] = (int32_t)((y_lo >> 8) + rand() % ((y_hi - y_lo) >> 8)) << 8;
+            vector_list.dxs[i] = (int32_t)(rand() % 2 ? 1 + rand() % 2 : -1 - rand() % 2);
+            vector_list.dys[i] = (int32_t)(rand() % 2 ? 1 + rand() % 2 : -1 - rand() % 2);
+        }
+        memcpy(scalar_list.xs, vector_list.xs, count * sizeof(int32_t));
+        memcpy(scalar_list.ys, vector_list.ys, count * sizeof(int32_t));
+        memcpy(scalar_list.dxs, vector_list.dxs, count * sizeof(int32_t));
+        memcpy(scalar_list.dys, vector_list.dys, count * sizeof(int32_t));
+        const int iterations = 200;
+        uint64_t start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            for (size_t i = 0; i < count; ++i) {
+                scalar_list.xs[i] = sprite_bounce(scalar_list.xs[i], x_lo, x_hi, scalar_list.dxs[i], ticks);
+                scalar_list.ys[i] = sprite_bounce(scalar_list.ys[i], y_lo, y_hi, scalar_list.dys[i], ticks);
+            }
+        }
+        const uint64_t scalar_ns = (now_ns() - start) / iterations;
+        start = now_ns();
+        for (int it = 0; it < iterations; ++it) {
+            sprite_integrate(vector_list.xs, vector_list.dxs, count, x_lo, x_hi, ticks);
+            sprite_integrate(vector_list.ys, vector_list.dys, count, y_lo, y_hi, ticks);
+        }
+        const uint64_t vector_ns = (now_ns() - start) / iterations;
+        if (0 != memcmp(scalar_list.xs, vector_list.xs, count * sizeof(int32_t)) ||
+            0 != memcmp(scalar_list.ys, vector_list.ys, count * sizeof(int32_t)) ||
+            0 != memcmp(scalar_list.dxs, vector_list.dxs, count * sizeof(int32_t)) ||
+            0 != memcmp(scalar_list.dys, vector_list.dys, count * sizeof(int32_t))) {
+            ++failures;
+        }
+        // every pair against the grid
+        start = now_ns();
+        size_t all_pairs = 0;
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j = i + 1; j < count; ++j) {
+                if (abs(vector_list.xs[i] - vector_list.xs[j]) < (extent << 8) &&
+                    abs(vector_list.ys[i] - vector_list.ys[j]) < (extent << 8)) {
+                    ++all_pairs;
+                }
+            }
+        }
+        const uint64_t all_pairs_ns = now_ns() - start;
+        start = now_ns();
+        const size_t grid_pairs = physics.overlaps(vector_list, extent);
+        const uint64_t grid_ns = now_ns() - start;
+        if (grid_pairs != all_pairs) {
+            ++failures;
+        }
+        // a run of colliding steps. The host can preempt a step past the
+        // budget on its own, so it takes three runs over to fail.
+        for (int run = 0; run < 3; ++run) {
+            physics.reset_counters();
+            for (int it = 0; it < 60; ++it) {
+                physics.step(vector_list, extent, x_lo, x_hi, y_lo, y_hi, ticks, true);
+            }
+            if (physics.max_us() <= physics.budget_us()) {
+                break;
+            }
+        }
+        if (physics.max_us() > physics.budget_us()) {
+            ++over_budget;
+        }
+        printf("  %-7zu %10.1f %10.1f %10.1f %10.1f %8zu %10u %10.1f %6u\n", count, (double)scalar_ns / count,
+               (double)vector_ns / count, all_pairs_ns / 1000.0, grid_ns / 1000.0, grid_pairs, (unsigned)physics.max_us(),
+               (double)physics.contacts() / physics.steps(), (unsigned)physics.over_budget());
+    }
+    printf("  (scalar/vector ns per bar per step, all pairs/grid us per search, step us is the worst of 60)\n");
+    printf("  %d bar counts where the vector step or the grid disagree (%s)\n", failures, failures == 0 ? "ok" : "FAILED");
+    printf("  %d bar counts with a step over budget (%s)\n", over_budget, over_budget == 0 ? "ok" : "FAILED");
+    vector_list.deallocate();
+    scalar_list.deallocate();
+    return failures == 0 && over_budget == 0 ? 0 : 1;
+}
+
+// closed-form bar motion against stepping it frame by frame: the pose at
+// every frame has to match exactly, with even and uneven frame times. Then
+// how far behind the wall clock the old clamped stepping falls when every
+// tenth frame stalls, which the closed form can't. Fails on any mismatch.
+static int bench_motion() {
+    constexpr static const size_t count = 1000;
+    constexpr static const int frames = 3000;
+    constexpr static const int32_t lo = 30 << 8, hi = (panel_width - 1 - 30) << 8;
+    int32_t* origins = (int32_t*)malloc(count * sizeof(int32_t));
+    int32_t* stepped = (int32_t*)malloc(count * sizeof(int32_t));
+    int32_t* posed = (int32_t*)malloc(count * sizeof(int32_t));
+    int32_t* deltas = (int32_t*)malloc(count * sizeof(int32_t));
+    int32_t* directions = (int32_t*)malloc(count * sizeof(int32_t));
+    int32_t* posed_directions = (int32_t*)malloc(count * sizeof(int32_t));
+    if (origins == nullptr || stepped == nullptr || posed == nullptr || deltas == nullptr || directions == nullptr ||
+        posed_directions == nullptr) {
+        puts("Out of memory");
+        return 1;
+    }
+    static const int32_t choices[] = {-2, -1, 1, 2};
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t h = sprite_hash(1, (uint32_t)i, 0);
+        origins[i] = lo + (int32_t)(h % (uint32_t)(hi - lo));
+        deltas[i] = choices[(h >> 24) & 3];
+    }
+    int failures = 0;
+    printf("motion: %zu bars, %d frames\n", count, frames);
+    // 30fps nominal, and 33ms frames, which come to 253 or 254 ticks
+    static const char* labels[] = {"even", "uneven"};
+    for (int uneven = 0; uneven < 2; ++uneven) {
+        memcpy(stepped, origins, count * sizeof(int32_t));
+        memcpy(directions, deltas, count * sizeof(int32_t));
+        int mismatched = 0;
+        int64_t ticks = 0;
+        uint64_t step_ns = 0, pose_ns = 0;
+        for (int f = 1; f <= frames; ++f) {
+            const int32_t elapsed = uneven ? (int32_t)((uint64_t)f * 33 * 7680 / 1000 - ticks) : 256;
+            ticks += elapsed;
+            uint64_t start = now_ns();
+            sprite_integrate(stepped, directions, count, lo, hi, elapsed);
+            step_ns += now_ns() - start;
+            start = now_ns();
+            sprite_pose(origins, deltas, posed, posed_directions, count, lo, hi, ticks);
+            pose_ns += now_ns() - start;
+            if (0 != memcmp(stepped, posed, count * sizeof(int32_t))) {
+                ++mismatched;
+            }
+        }
+        failures += mismatched;
+        printf("  %-7s %5.2f ns/bar stepped %5.2f ns/bar posed, %d frames differ\n", labels[uneven],
+               (double)step_ns / frames / count, (double)pose_ns / frames / count, mismatched);
+    }
+    // every tenth frame takes 150ms more. The old stepping clamped each
+    // frame to 100ms of motion, so it lost the rest for good.
+    uint64_t wall_ms = 0, clamped_ms = 0;
+    for (int f = 1; f <= 300; ++f) {
+        const uint32_t frame_ms = (f % 10) == 0 ? 183 : 33;
+        wall_ms += frame_ms;
+        clamped_ms += frame_ms > 100 ? 100 : frame_ms;
+    }
+    printf("  stalls: after %.1fs the clamped stepping is %.1fs behind, closed form 0.0s\n", wall_ms / 1000.0,
+           (wall_ms - clamped_ms) / 1000.0);
+    printf("  %d frames where closed form differs from stepping (%s)\n", failures, failures == 0 ? "ok" : "FAILED");
+    free(origins);
+    free(stepped);
+    free(posed);
+    free(deltas);
+    free(directions);
+    free(posed_directions);
+    return failures == 0 ? 0 : 1;
+}
+
+// feeds the governor a made up frame cost that depends on the load and
+// the level, with some noise, through phases meant to trip it up
+static int bench_governor() {
+    constexpr static const uint32_t budget_us = 33333;
+    // what each level costs relative to full quality
+    static const double level_cost[quality_governor::level_count] = {1.0, 0.95, 0.8, 0.55, 0.3, 0.25};
+    struct phase {
+        const char* label;
+        uint32_t load_us;  // full quality frame cost
+        int frames;
+    };
+    // edge: the lowest level is under the climb threshold, but the one
+    // above it is over budget, so every climb has to be undone
+    static const phase phases[] = {
+        {"light", 20000, 300},
+        {"heavy", 60000, 600},
+        {"edge", 62000, 1800},
+        {"recover", 15000, 900},
+    };
+    quality_governor governor;
+    governor.budget_us(budget_us);
+    printf("governor: %uus budget, levels cost", (unsigned)budget_us);
+    for (size_t i = 0; i < quality_governor::level_count; ++i) {
+        printf(" %.2f", level_cost[i]);
+    }
+    printf(" of full quality\n");
+    printf("  %-8s %8s %7s %8s %14s %s\n", "phase", "load", "frames", "changes", "last 100 avg", "final level");
+    uint32_t noise = 1;
+    bool ok = true;
+    for (const phase& p : phases) {
+        governor.reset_counters();
+        uint64_t tail_us = 0;
+        for (int f = 0; f < p.frames; ++f) {
+            noise = noise * 1103515245 + 12345;
+            // +-5%
+            const double jitter = 0.95 + ((noise >> 16) & 0x3FF) / 10240.0;
+            const uint32_t cost = (uint32_t)(p.load_us * level_cost[governor.level()] * jitter);
+            governor.add(cost);
+            if (f >= p.frames - 100) {
+                tail_us += cost;
+            }
+        }
+        const uint32_t tail = (uint32_t)(tail_us / 100);
+        printf("  %-8s %6uus %7d %8u %12uus %zu\n", p.label, (unsigned)p.load_us, p.frames, (unsigned)governor.changes(),
+               (unsigned)tail, governor.level());
+        // every phase should end within budget, light ones at full quality,
+        // and the edge shouldn't flap every couple of seconds
+        ok = ok && tail <= budget_us;
+        if (p.load_us < budget_us * quality_governor::up_percent / 100) {
+            ok = ok && governor.level() == 0;
+        }
+        if (0 == strcmp(p.label, "edge")) {
+            ok = ok && governor.changes() <= 12;
+        }
+    }
+    printf("  %s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+// startup cost of getting the background into RAM from each asset format
+static int bench_asset() {
+    constexpr static const int iterations = 20;
+    uint8_t* ref = (uint8_t*)malloc(screen_bytes);
+    uint8_t* dst = (uint8_t*)malloc(screen_bytes);
+    if (ref == nullptr || dst == nullptr) {
+        puts("Out of memory");
+        return 1;
+    }
+    if (!decode_jpeg(ref)) {
+        puts("Unable to decode the JPEG");
+        return 1;
+    }
+    const std::vector<uint8_t> raw = make_asset(ref, rgb565_asset_format::raw);
+    const std::vector<uint8_t> lz4 = make_asset(ref, rgb565_asset_format::lz4);
+    printf("asset: %dx%d background, %d loads each\n", panel_width, panel_height, iterations);
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; ++i) {
+        decode_jpeg(dst);
+    }
+    printf("  %-6s %8zu bytes flash %9.3fms/load\n", "jpeg", jpeg_asset_size(), (now_ns() - start) / 1e6 / iterations);
+    bool ok = true;
+    const std::vector<uint8_t>* assets[] = {&raw, &lz4};
+    const char* names[] = {"raw", "lz4"};
+    for (int a = 0; a < 2; ++a) {
+        memset(dst, 0, screen_bytes);
+        bool loaded = true;
+        start = now_ns();
+        for (int i = 0; i < iterations; ++i) {
+            loaded = rgb565_asset_load(assets[a]->data(), assets[a]->size(), dst, panel_width, panel_height) && loaded;
+        }
+        const uint64_t ns = now_ns() - start;
+        const bool same = loaded && 0 == memcmp(ref, dst, screen_bytes);
+        ok = ok && same;
+        printf("  %-6s %8zu bytes flash %9.3fms/load %s\n", names[a], assets[a]->size(), ns / 1e6 / iterations,
+               same ? "" : "(FAILED: doesn't match the JPEG decode)");
+    }
+    free(ref);
+    free(dst);
+    return ok ? 0 : 1;
+}
+
+// the real bg_task against the paint side's changed(): the front frame has
+// to be the whole source tinted with the step it claims, from its handoff
+// until the next one, while bg_task composes the next step into the other
+// frame. Half the frames give bg_task time to finish, so some steps
+// are ready when they're due and some are late.
+static int bench_handoff() {
+    constexpr static const int frames = 600;
+    uint8_t* source = (uint8_t*)malloc(screen_bytes);
+    uint8_t* expected = (uint8_t*)malloc(screen_bytes);
+    if (source == nullptr || expected == nullptr || !decode_jpeg(source)) {
+        puts("Unable to decode the JPEG");
+        return 1;
+    }
+    virtual_clock(true);
+    screen_t screen;
+    screen.dimensions({panel_width, panel_height});
+    warhol_box_t box(screen);
+    box.bounds(screen.bounds());
+    box.seed(7);
+    box.on_before_paint();
+    if (!box.ready()) {
+        puts("Unable to allocate the box");
+        return 1;
+    }
+    int checked = 0, mismatched = 0, ahead = 0;
+    uint32_t last_tint = 0;
+    for (int i = 0; i < frames; ++i) {
+        // a tint step is due every 8 nominal frames, about 267ms
+        advance_clock(i % 3 == 0 ? 270 : 40);
+        box.on_before_paint();
+        gfx::srect16 rects[warhol_box_t::max_changed];
+        box.changed(rects);
+        warhol_box_t::frame_state state;
+        box.snapshot(&state);
+        const gfx::rgba_pixel<32> tint = box.background_tint();
+        if (checked == 0 || tint.native_value != last_tint) {
+            last_tint = tint.native_value;
+            rgb565_blend(expected, source, screen_pixels,
+                         rgb565_make_tint(tint.channel<gfx::channel_name::R>(), tint.channel<gfx::channel_name::G>(),
+                                          tint.channel<gfx::channel_name::B>(), tint.channel<gfx::channel_name::A>()));
+            ++checked;
+        }
+        // it has to stay that way until the next handoff, too
+        if (0 != memcmp(expected, state.background, screen_bytes)) {
+            ++mismatched;
+        }
+        if (box.backgrounds_produced() > box.backgrounds_consumed() + 1) {
+            ++ahead;
+        }
+        box.on_after_paint();
+        if (i & 1) {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+    const uint32_t produced = box.backgrounds_produced(), consumed = box.backgrounds_consumed();
+    printf("handoff: %d frames, %u backgrounds produced, %u consumed, %d fronts checked every frame\n", frames, (unsigned)produced,
+           (unsigned)consumed, checked);
+    const bool ok = mismatched == 0 && ahead == 0 && consumed >= (uint32_t)frames / 6;
+    if (mismatched != 0) {
+        printf("  FAILED: %d frames' fronts didn't match their tint\n", mismatched);
+    }
+    if (ahead != 0) {
+        printf("  FAILED: bg_task got more than one step ahead %d times\n", ahead);
+    }
+    if (consumed < (uint32_t)frames / 6) {
+        printf("  FAILED: only %u handoffs\n", (unsigned)consumed);
+    }
+    free(source);
+    free(expected);
+    return ok ? 0 : 1;
+}
+
+struct bench_entry {
+    const char* name;
+    const char* description;
+    int (*run)();
+};
+static const bench_entry benches[] = {
+    {"tint", "background copy+tint: gfx vs two-pass vs fused SWAR", bench_tint},
+    {"fill", "translucent rect fill: gfx generic path vs packed RGB565", bench_fill},
+    {"blend", "8.8 animation colors vs float blend, fails above 1 LSB", bench_blend},
+    {"asset", "background load: JPEG decode vs raw vs LZ4 RGB565, fails on mismatch", bench_asset},
+    {"planner", "dirty rect coalescing: windows and bytes, fails on lost pixels", bench_planner},
+    {"sprites", "3-5000 sprites composed per stripe: naive vs binned, fails on mismatch", bench_sprites},
+    {"scale", "full vs half resolution composed and pixel doubled into stripes, fails on bad doubling", bench_scale},
+    {"handoff", "bg_task vs changed() background double buffer, fails on a torn or mistinted front", bench_handoff},
+    {"motion", "closed-form bar poses vs frame stepping, fails on any difference", bench_motion},
+    {"physics", "100-5000 bars: vector vs scalar step, grid vs all-pairs overlaps, steps vs budget", bench_physics},
+    {"governor", "quality levels under light, heavy and borderline load, fails on overruns or flapping", bench_governor},
+    {"stripes", "work-stealing stripe scheduler: balance over 1-4 threads, fails on lost or repeated stripes", bench_stripes},
+};
+int bench(const char* name) {
+    for (const bench_entry& entry : benches) {
+        if (0 == strcmp(name, entry.name)) {
+            return entry.run();
+        }
+    }
+    puts("Benchmarks:");
+    for (const bench_entry& entry : benches) {
+        printf("  %-10s %s\n", entry.name, entry.description);
+    }
+    return 0 == strcmp(name, "list") ? 0 : 1;
+}
+}  // namespace sim
@@ -0,0 +1,576 @@
+// host simulator implementation of the ESP-IDF and FreeRTOS pieces the
+// firmware touches. FreeRTOS tasks run as pthreads and the ILI9342 is an
+// in-memory RGB565 framebuffer. "DMA" completes synchronously, or with
+// spi_timing() on a thread that takes as long as the SPI bus would.
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include <driver/spi_master.h>
+#include <esp_lcd_panel_io.h>
+#include <esp_lcd_panel_ops.h>
+#include <esp_lcd_panel_ili9342.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "sim.hpp"
+
+struct sim_task {
+    pthread_t thread;
+    char name[16];
+    TaskFunction_t fn;
+    void* arg;
+    int core;
+    std::atomic<bool> deleted;
+    std::mutex lock;
+    std::condition_variable signal;
+    uint32_t notifications;
+};
+static sim_task sim_main_task;
+static thread_local sim_task* sim_current_task = nullptr;
+
+static sim_task* sim_current() {
+    return sim_current_task != nullptr ? sim_current_task : &sim_main_task;
+}
+// a deleted task unwinds the next time it yields
+static void sim_check_deleted() {
+    sim_task* task = sim_current_task;
+    if (task != nullptr && task->deleted.load()) {
+        pthread_exit(nullptr);
+    }
+}
+static void* sim_task_entry(void* arg) {
+    sim_task* task = (sim_task*)arg;
+    sim_current_task = task;
+    task->fn(task->arg);
+    return nullptr;
+}
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg, UBaseType_t priority, TaskHandle_t* out_handle, BaseType_t core_id) {
+    sim_task* task = new sim_task();
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->fn = fn;
+    task->arg = arg;
+    task->core = core_id;
+    task->deleted = false;
+    task->notifications = 0;
+    if (0 != pthread_create(&task->thread, nullptr, sim_task_entry, task)) {
+        delete task;
+        if (out_handle != nullptr) {
+            *out_handle = nullptr;
+        }
+        return pdFAIL;
+    }
+    if (out_handle != nullptr) {
+        *out_handle = task;
+    }
+    return pdPASS;
+}
+void vTaskDelete(TaskHandle_t handle) {
+    if (handle == nullptr || handle == sim_current_task) {
+        if (sim_current_task == nullptr) {
+            return;
+        }
+        pthread_detach(sim_current_task->thread);
+        pthread_exit(nullptr);
+    }
+    {
+        std::lock_guard<std::mutex> guard(handle->lock);
+        handle->deleted = true;
+    }
+    handle->signal.notify_all();
+    pthread_join(handle->thread, nullptr);
+    delete handle;
+}
+static uint64_t sim_now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+static uint64_t sim_now_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+void vTaskDelay(TickType_t ticks) {
+    sim_check_deleted();
+    timespec ts;
+    ts.tv_sec = pdTICKS_TO_MS(ticks) / 1000;
+    ts.tv_nsec = (pdTICKS_TO_MS(ticks) % 1000) * 1000000;
+    nanosleep(&ts, nullptr);
+    sim_check_deleted();
+}
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+    sim_task* task = sim_current();
+    uint32_t result;
+    {
+        std::unique_lock<std::mutex> guard(task->lock);
+        auto ready = [task]() { return task->notifications != 0 || task->deleted.load(); };
+        if (ticks_to_wait == portMAX_DELAY) {
+            task->signal.wait(guard, ready);
+        } else {
+            task->signal.wait_for(guard, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), ready);
+        }
+        result = task->notifications;
+        if (result != 0) {
+            task->notifications = clear_count_on_exit ? 0 : result - 1;
+        }
+    }
+    sim_check_deleted();
+    return result;
+}
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+    {
+        std::lock_guard<std::mutex> guard(handle->lock);
+        ++handle->notifications;
+    }
+    handle->signal.notify_one();
+    return pdPASS;
+}
+int64_t esp_timer_get_time() {
+    static const uint64_t start_us = sim_now_us();
+    return (int64_t)(sim_now_us() - start_us);
+}
+static std::atomic<bool> sim_virtual_clock(false);
+static std::atomic<uint64_t> sim_virtual_ms(0);
+TickType_t xTaskGetTickCount() {
+    static const uint64_t start_ms = sim_now_ms();
+    if (sim_virtual_clock) {
+        return pdMS_TO_TICKS(sim_virtual_ms.load());
+    }
+    return pdMS_TO_TICKS(sim_now_ms() - start_ms);
+}
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return sim_current();
+}
+char* pcTaskGetName(TaskHandle_t handle) {
+    static char main_name[] = "main";
+    sim_task* task = handle == nullptr ? sim_current() : handle;
+    return task == &sim_main_task ? main_name : task->name;
+}
+BaseType_t xTaskGetCoreID(TaskHandle_t handle) {
+    return handle == nullptr ? sim_current()->core : handle->core;
+}
+BaseType_t xPortGetCoreID() {
+    return sim_current()->core;
+}
+
+struct sim_semaphore {
+    std::mutex lock;
+    std::condition_variable signal;
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    sim_semaphore* result = new sim_semaphore();
+    result->count = initial_count;
+    result->max_count = max_count;
+    return result;
+}
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    sim_check_deleted();
+    std::unique_lock<std::mutex> guard(semaphore->lock);
+    auto ready = [semaphore]() { return semaphore->count != 0; };
+    if (ticks_to_wait == portMAX_DELAY) {
+        semaphore->signal.wait(guard, ready);
+    } else if (!semaphore->signal.wait_for(guard, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), ready)) {
+        return pdFALSE;
+    }
+    --semaphore->count;
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    // notify under the lock: like FreeRTOS, the taker may delete the
+    // semaphore as soon as it wakes
+    std::lock_guard<std::mutex> guard(semaphore->lock);
+    if (semaphore->count == semaphore->max_count) {
+        return pdFALSE;
+    }
+    ++semaphore->count;
+    semaphore->signal.notify_one();
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higher_priority_task_woken) {
+    if (higher_priority_task_woken != nullptr) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    return xSemaphoreGive(semaphore);
+}
+
+struct sim_queue {
+    std::mutex lock;
+    std::condition_variable signal;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+};
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    sim_queue* result = new sim_queue();
+    result->length = length;
+    result->item_size = item_size;
+    return result;
+}
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait) {
+    sim_check_deleted();
+    {
+        std::unique_lock<std::mutex> guard(queue->lock);
+        auto ready = [queue]() { return queue->items.size() < queue->length; };
+        if (ticks_to_wait == portMAX_DELAY) {
+            queue->signal.wait(guard, ready);
+        } else if (!queue->signal.wait_for(guard, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), ready)) {
+            return pdFALSE;
+        }
+        const uint8_t* bytes = (const uint8_t*)item;
+        queue->items.emplace_back(bytes, bytes + queue->item_size);
+    }
+    queue->signal.notify_all();
+    return pdTRUE;
+}
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higher_priority_task_woken) {
+    if (higher_priority_task_woken != nullptr) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if (queue->items.size() == queue->length) {
+            return pdFALSE;
+        }
+        const uint8_t* bytes = (const uint8_t*)item;
+        queue->items.emplace_back(bytes, bytes + queue->item_size);
+    }
+    queue->signal.notify_all();
+    return pdTRUE;
+}
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks_to_wait) {
+    sim_check_deleted();
+    {
+        std::unique_lock<std::mutex> guard(queue->lock);
+        auto ready = [queue]() { return !queue->items.empty(); };
+        if (ticks_to_wait == portMAX_DELAY) {
+            queue->signal.wait(guard, ready);
+        } else if (!queue->signal.wait_for(guard, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), ready)) {
+            return pdFALSE;
+        }
+        memcpy(item, queue->items.front().data(), queue->item_size);
+        queue->items.pop_front();
+    }
+    queue->signal.notify_all();
+    return pdTRUE;
+}
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    return (UBaseType_t)queue->items.size();
+}
+
+// a pretend internal DMA heap, roughly what an ESP32 with PSRAM has left
+// after boot: some free space, fragmented into smaller largest blocks
+static std::mutex sim_heap_lock;
+static size_t sim_dma_free = 160 * 1024;
+static size_t sim_dma_largest = 110 * 1024;
+static std::unordered_map<void*, size_t> sim_dma_blocks;
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    if (0 == (caps & MALLOC_CAP_DMA)) {
+        return malloc(size);
+    }
+    std::lock_guard<std::mutex> guard(sim_heap_lock);
+    if (size > sim_dma_free || size > sim_dma_largest) {
+        return nullptr;
+    }
+    void* result = malloc(size);
+    if (result != nullptr) {
+        sim_dma_free -= size;
+        sim_dma_blocks[result] = size;
+    }
+    return result;
+}
+void heap_caps_free(void* ptr) {
+    {
+        std::lock_guard<std::mutex> guard(sim_heap_lock);
+        auto it = sim_dma_blocks.find(ptr);
+        if (it != sim_dma_blocks.end()) {
+            sim_dma_free += it->second;
+            sim_dma_blocks.erase(it);
+        }
+    }
+    free(ptr);
+}
+size_t heap_caps_get_free_size(uint32_t caps) {
+    if (0 == (caps & MALLOC_CAP_DMA)) {
+        return 4 * 1024 * 1024;
+    }
+    std::lock_guard<std::mutex> guard(sim_heap_lock);
+    return sim_dma_free;
+}
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    if (0 == (caps & MALLOC_CAP_DMA)) {
+        return 4 * 1024 * 1024;
+    }
+    std::lock_guard<std::mutex> guard(sim_heap_lock);
+    return sim_dma_free < sim_dma_largest ? sim_dma_free : sim_dma_largest;
+}
+
+// the "warhol" data partition is whatever file sim::partition_file()
+// names, mapped read-only the way the flash cache maps the real one
+static const char* sim_partition_path = nullptr;
+static esp_partition_t sim_partition;
+static const void* sim_partition_ptr = nullptr;
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    struct stat st;
+    if (sim_partition_path == nullptr || type != ESP_PARTITION_TYPE_DATA ||
+        (label != nullptr && 0 != strcmp(label, "warhol")) || 0 != stat(sim_partition_path, &st)) {
+        return nullptr;
+    }
+    sim_partition.type = ESP_PARTITION_TYPE_DATA;
+    sim_partition.subtype = 0x40;
+    sim_partition.address = 0x190000;
+    sim_partition.size = (uint32_t)st.st_size;
+    strcpy(sim_partition.label, "warhol");
+    sim_partition.encrypted = false;
+    return &sim_partition;
+}
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle) {
+    if (partition != &sim_partition || offset + size > partition->size || sim_partition_ptr != nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const int fd = open(sim_partition_path, O_RDONLY);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+    void* ptr = mmap(nullptr, partition->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return ESP_ERR_NO_MEM;
+    }
+    sim_partition_ptr = ptr;
+    *out_ptr = (const uint8_t*)ptr + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+    if (handle == 1 && sim_partition_ptr != nullptr) {
+        munmap((void*)sim_partition_ptr, sim_partition.size);
+        sim_partition_ptr = nullptr;
+    }
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t* config, spi_dma_chan_t dma_chan) {
+    return ESP_OK;
+}
+
+struct sim_lcd_panel_io {
+    esp_lcd_panel_io_spi_config_t config;
+};
+struct sim_lcd_panel {
+    sim_lcd_panel_io* io;
+};
+static sim_lcd_panel_io sim_io;
+static sim_lcd_panel sim_panel;
+static uint16_t sim_gram[sim::panel_width * sim::panel_height];
+static sim::panel_counters sim_stats;
+static std::mutex sim_panel_lock;
+// CASET and RASET with 4 parameter bytes each, then RAMWR
+constexpr static const size_t sim_window_overhead = 11;
+// esp_lcd sends those as five polled transactions of about 10us each,
+// after the queued color transfers drain, so the bus idles that long per
+// window (flush_planner's window cost)
+constexpr static const uint64_t sim_window_ns = 50000;
+
+esp_err_t esp_lcd_new_panel_io_spi(esp_lcd_spi_bus_handle_t bus, const esp_lcd_panel_io_spi_config_t* io_config, esp_lcd_panel_io_handle_t* ret_io) {
+    sim_io.config = *io_config;
+    *ret_io = &sim_io;
+    return ESP_OK;
+}
+esp_err_t esp_lcd_new_panel_ili9342(esp_lcd_panel_io_handle_t io, const esp_lcd_panel_dev_config_t* panel_dev_config, esp_lcd_panel_handle_t* ret_panel) {
+    sim_panel.io = io;
+    *ret_panel = &sim_panel;
+    return ESP_OK;
+}
+static std::atomic<bool> sim_spi_timing(false);
+// with SPI timing, reset and init take as long as the ILI9342 driver's
+// delays: 20ms after the software reset, and 100ms after sleep out plus
+// sending the gamma and power tables
+esp_err_t esp_lcd_panel_reset(esp_lcd_panel_handle_t panel) {
+    memset(sim_gram, 0, sizeof(sim_gram));
+    if (sim_spi_timing) {
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    return ESP_OK;
+}
+esp_err_t esp_lcd_panel_init(esp_lcd_panel_handle_t panel) {
+    if (sim_spi_timing) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    return ESP_OK;
+}
+esp_err_t esp_lcd_panel_mirror(esp_lcd_panel_handle_t panel, bool mirror_x, bool mirror_y) { return ESP_OK; }
+esp_err_t esp_lcd_panel_swap_xy(esp_lcd_panel_handle_t panel, bool swap_axes) { return ESP_OK; }
+esp_err_t esp_lcd_panel_set_gap(esp_lcd_panel_handle_t panel, int x_gap, int y_gap) { return ESP_OK; }
+esp_err_t esp_lcd_panel_invert_color(esp_lcd_panel_handle_t panel, bool invert_color_data) { return ESP_OK; }
+esp_err_t esp_lcd_panel_disp_on_off(esp_lcd_panel_handle_t panel, bool on_off) { return ESP_OK; }
+
+// one window on its way to the panel
+struct sim_transfer {
+    sim_lcd_panel* panel;
+    int x_start, y_start, x_end, y_end;
+    const void* color_data;
+};
+// lands a transfer in GRAM and signals it done, like the SPI DMA would
+static void sim_complete(const sim_transfer& transfer) {
+    const int x_start = transfer.x_start, y_start = transfer.y_start;
+    const int x_end = transfer.x_end, y_end = transfer.y_end;
+    {
+        std::lock_guard<std::mutex> guard(sim_panel_lock);
+        // the wire format is big-endian RGB565
+        const uint8_t* src = (const uint8_t*)transfer.color_data;
+        for (int y = y_start; y < y_end; ++y) {
+            uint16_t* dst = sim_gram + y * sim::panel_width + x_start;
+            for (int x = x_start; x < x_end; ++x) {
+                *dst++ = (uint16_t)((src[0] << 8) | src[1]);
+                src += 2;
+            }
+        }
+        const size_t pixels = (size_t)(x_end - x_start) * (y_end - y_start);
+        ++sim_stats.windows;
+        sim_stats.pixels += pixels;
+        sim_stats.bytes += pixels * 2 + sim_window_overhead;
+    }
+    esp_lcd_panel_io_event_data_t edata;
+    edata.dummy = 0;
+    sim_lcd_panel_io* io = transfer.panel->io;
+    if (io->config.on_color_trans_done != nullptr) {
+        io->config.on_color_trans_done(io, &edata, io->config.user_ctx);
+    }
+}
+struct sim_dma {
+    std::mutex lock;
+    std::condition_variable signal;
+    std::deque<sim_transfer> queue;
+    bool busy = false;
+};
+// never destroyed: the DMA thread is still waiting on it at exit, and
+// destroying a condition variable with waiters blocks forever
+static sim_dma& sim_dma_state = *new sim_dma();
+// sends queued transfers one at a time at the panel's SPI clock. The
+// pixels are read only once the time is up, so a buffer reused too early
+// shows up on screen.
+static void sim_dma_thread() {
+    // Linux lets a sleep run 50us long by default, which would add to
+    // every window on top of sim_window_ns
+    prctl(PR_SET_TIMERSLACK, 1);
+    while (true) {
+        sim_transfer transfer;
+        {
+            std::unique_lock<std::mutex> guard(sim_dma_state.lock);
+            sim_dma_state.signal.wait(guard, []() { return !sim_dma_state.queue.empty(); });
+            transfer = sim_dma_state.queue.front();
+        }
+        const size_t bytes = (size_t)(transfer.x_end - transfer.x_start) * (transfer.y_end - transfer.y_start) * 2;
+        const unsigned int pclk_hz = transfer.panel->io->config.pclk_hz;
+        const uint64_t ns = pclk_hz == 0 ? 0 : sim_window_ns + (uint64_t)bytes * 8 * 1000000000 / pclk_hz;
+        timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        nanosleep(&ts, nullptr);
+        sim_complete(transfer);
+        {
+            std::lock_guard<std::mutex> guard(sim_dma_state.lock);
+            sim_dma_state.queue.pop_front();
+            sim_dma_state.busy = !sim_dma_state.queue.empty();
+        }
+        sim_dma_state.signal.notify_all();
+    }
+}
+esp_err_t esp_lcd_panel_draw_bitmap(esp_lcd_panel_handle_t panel, int x_start, int y_start, int x_end, int y_end, const void* color_data) {
+    if (panel == nullptr || x_start >= x_end || y_start >= y_end ||
+        x_start < 0 || y_start < 0 || x_end > sim::panel_width || y_end > sim::panel_height) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const sim_transfer transfer = {panel, x_start, y_start, x_end, y_end, color_data};
+    if (!sim_spi_timing) {
+        sim_complete(transfer);
+        return ESP_OK;
+    }
+    static std::once_flag started;
+    std::call_once(started, []() { std::thread(sim_dma_thread).detach(); });
+    std::unique_lock<std::mutex> guard(sim_dma_state.lock);
+    // esp_lcd sends CASET/RASET as polling transactions, which first wait
+    // for every queued color transfer to finish
+    sim_dma_state.signal.wait(guard, []() { return !sim_dma_state.busy; });
+    sim_dma_state.queue.push_back(transfer);
+    sim_dma_state.busy = true;
+    guard.unlock();
+    sim_dma_state.signal.notify_all();
+    return ESP_OK;
+}
+
+namespace sim {
+void spi_timing(bool enabled) {
+    sim_spi_timing = enabled;
+}
+void dma_heap(size_t free_size, size_t largest_block) {
+    std::lock_guard<std::mutex> guard(sim_heap_lock);
+    sim_dma_free = free_size;
+    sim_dma_largest = largest_block;
+}
+void partition_file(const char* path) {
+    sim_partition_path = path;
+}
+void virtual_clock(bool enabled) {
+    sim_virtual_ms = xTaskGetTickCount();
+    sim_virtual_clock = enabled;
+}
+void advance_clock(uint32_t ms) {
+    sim_virtual_ms += ms;
+}
+const uint16_t* framebuffer() {
+    return sim_gram;
+}
+panel_counters counters() {
+    std::lock_guard<std::mutex> guard(sim_panel_lock);
+    return sim_stats;
+}
+void reset_counters() {
+    std::lock_guard<std::mutex> guard(sim_panel_lock);
+    memset(&sim_stats, 0, sizeof(sim_stats));
+}
+bool write_ppm(const char* path) {
+    std::lock_guard<std::mutex> guard(sim_panel_lock);
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", panel_width, panel_height);
+    for (size_t i = 0; i < sizeof(sim_gram) / sizeof(sim_gram[0]); ++i) {
+        const uint16_t px = sim_gram[i];
+        uint8_t rgb[3];
+        rgb[0] = (uint8_t)(((px >> 11) & 31) * 255 / 31);
+        rgb[1] = (uint8_t)(((px >> 5) & 63) * 255 / 63);
+        rgb[2] = (uint8_t)((px & 31) * 255 / 31);
+        fwrite(rgb, 1, sizeof(rgb), file);
+    }
+    return 0 == fclose(file);
+}
+}  // namespace sim
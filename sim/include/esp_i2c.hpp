@@ -0,0 +1,11 @@
+#pragma once
+// host simulator stand-in for htcw_esp_i2c. There is no bus.
+namespace esp_idf {
+template <int Port, int Sda, int Scl>
+class esp_i2c {
+   public:
+    static esp_i2c instance;
+};
+template <int Port, int Sda, int Scl>
+esp_i2c<Port, Sda, Scl> esp_i2c<Port, Sda, Scl>::instance;
+}  // namespace esp_idf
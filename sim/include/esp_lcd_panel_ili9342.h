@@ -0,0 +1,3 @@
+#pragma once
+#include "esp_lcd_panel_vendor.h"
+esp_err_t esp_lcd_new_panel_ili9342(esp_lcd_panel_io_handle_t io, const esp_lcd_panel_dev_config_t* panel_dev_config, esp_lcd_panel_handle_t* ret_panel);
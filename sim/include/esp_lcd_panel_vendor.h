@@ -0,0 +1,9 @@
+#pragma once
+#include "esp_lcd_panel_io.h"
+typedef enum { LCD_RGB_ENDIAN_RGB = 0, LCD_RGB_ENDIAN_BGR = 1 } lcd_rgb_element_order_t;
+typedef struct {
+    int reset_gpio_num;
+    lcd_rgb_element_order_t rgb_endian;
+    uint32_t bits_per_pixel;
+    void* vendor_config;
+} esp_lcd_panel_dev_config_t;
@@ -0,0 +1,6 @@
+#pragma once
+// host simulator stand-in: microseconds of CLOCK_MONOTONIC since startup.
+// Unlike the tick count it never follows the virtual clock, so timings
+// are real host time.
+#include <stdint.h>
+int64_t esp_timer_get_time();
@@ -0,0 +1,9 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef struct sim_semaphore* SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+#define xSemaphoreCreateBinary() xSemaphoreCreateCounting(1, 0)
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higher_priority_task_woken);
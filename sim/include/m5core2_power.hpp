@@ -0,0 +1,10 @@
+#pragma once
+// host simulator stand-in for htcw_m5core2_power. There is no AXP192.
+namespace esp_idf {
+class m5core2_power {
+   public:
+    template <typename Bus>
+    m5core2_power(Bus& bus) {}
+    bool initialize() { return true; }
+};
+}  // namespace esp_idf
@@ -0,0 +1,315 @@
+// host simulator entry point. Runs the firmware's app_main() and loop()
+// against the fake panel, reports what was pushed and dumps the screen.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "ui.hpp"
+#include "panel.hpp"
+#include "sim.hpp"
+
+extern "C" void app_main();
+void loop();
+
+static uint64_t now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+static void usage(const char* exe) {
+    printf("Usage: %s [--frames <count>] [--fps <rate>] [--target-fps <rate>] [--invalidate full|dirty|coalesced|compare] [--render uix|direct] [--workers <count>] [--depth <frames>] [--sprites <count>] [--sprite-size <pixels>] [--collide] [--physics-budget <us>] [--seed <n>] [--seek <ms>] [--pause-after <frames>] [--budget <us>] [--scale 1|2] [--interlace] [--spi] [--no-preload] [--ppm <file>] [--trace <file>] [--partition <file>]\n", exe);
+    printf("       %s --sweep-buffers [--frames <count>]\n", exe);
+    printf("       %s --export-asset raw|lz4 <file>\n", exe);
+    printf("       %s --bench <name>|list\n", exe);
+    printf("  --frames <count>    frames to render per run (default 300)\n");
+    printf("  --fps <rate>        advance a virtual clock by 1/rate s per frame, 0 for wall time (default 30)\n");
+    printf("  --target-fps <rate> pace loop() to this rate on wall time, skipping overrun frames (default unpaced)\n");
+    printf("  --invalidate <how>  full screen, dirty rects or coalesced dirty rects each frame, or all three (default compare)\n");
+    printf("  --render <how>      paint through UIX or straight into the transfer buffers (default uix)\n");
+    printf("  --workers <count>   threads the direct renderer splits each frame between (default 2, max 4)\n");
+    printf("  --depth <frames>    direct mode frames in flight: 1 for low latency, 2+ for throughput (default 2)\n");
+    printf("  --sprites <count>   bars bouncing over the background (default 3)\n");
+    printf("  --sprite-size <pixels>  width and height of each bar (default 60)\n");
+    printf("  --collide           bars bounce off each other as well as the edges\n");
+    printf("  --physics-budget <us>  most time a frame spends colliding bars (default 2000)\n");
+    printf("  --seed <n>          seed for the bar positions and colors (default: from the clock)\n");
+    printf("  --seek <ms>         start the animation this far in, without running the frames before it\n");
+    printf("  --pause-after <frames>  pause the animation this many frames into each run, and resume after\n");
+    printf("  --budget <us>       turn quality down to keep frames within this, 0 for one --target-fps period (default off)\n");
+    printf("  --scale 1|2         direct mode render resolution: full, or half and pixel doubled (default 1)\n");
+    printf("  --interlace         direct mode sends the even and odd rows on alternate frames\n");
+    printf("  --spi               make transfers take as long as the 40MHz SPI bus would\n");
+    printf("  --no-preload        decode the background on the first paint instead of during panel_init()\n");
+    printf("  --sweep-buffers     report direct mode FPS over SPI for several transfer buffer configurations\n");
+    printf("  --ppm <file>        where to dump the final screen (default warhol.ppm)\n");
+    printf("  --trace <file>      dump the last trace events as Chrome trace JSON\n");
+    printf("  --partition <file>  use a raw asset file as the warhol flash partition\n"
+           "                      (builds with -DWARHOL_ASSET_PARTITION only)\n");
+    printf("  --export-asset      write the background as a pre-decoded RGB565 asset header (or .bin)\n");
+    printf("  --bench <name>      run a kernel micro-benchmark instead\n");
+}
+static int fps = 30;
+static int pause_after = -1;
+// renders frames and reports the cost and panel traffic per frame
+static void run(const char* label, int frames) {
+    panel_flush_wait();
+    sim::reset_counters();
+    panel_scheduler.reset_stolen();
+    const uint32_t fields = panel_field_frames;
+    const uint64_t start_ts = now_us();
+    int idle = 0;
+    for (int i = 0; i < frames; ++i) {
+        if (i == pause_after) {
+            main_box.paused(true);
+        }
+        if (fps > 0) {
+            sim::advance_clock(1000 / fps);
+        }
+        if (!panel_frame_due()) {
+            ++idle;
+        }
+        loop();
+    }
+    panel_flush_wait();
+    if (main_box.paused()) {
+        main_box.paused(false);
+    }
+    const uint64_t total_us = now_us() - start_ts;
+    const sim::panel_counters counters = sim::counters();
+    printf("%s: %d frames, %.3fms/frame, %llu pixels/frame, %llu bytes/frame, %.1f windows/frame\n",
+           label,
+           frames,
+           total_us / 1000.0 / frames,
+           (unsigned long long)(counters.pixels / frames),
+           (unsigned long long)(counters.bytes / frames),
+           (double)counters.windows / frames);
+    if (idle != 0) {
+        printf("  %d frames idle, with nothing due\n", idle);
+    }
+    if (panel_direct && panel_interlace) {
+        // every frame that isn't idle moves the bars, but a field frame
+        // only lands every other row of it
+        printf("  interlaced: %u frames sent as one field, %.1f motion updates/s\n",
+               (unsigned)(panel_field_frames - fields), (frames - idle) * 1000000.0 / total_us);
+    }
+    if (panel_direct && panel_render_workers > 1) {
+        printf("  %u stripes stolen across %d workers\n", (unsigned)panel_scheduler.stolen(), (int)panel_render_workers);
+    }
+}
+// panel_init() only allocates once, so each transfer buffer configuration
+// runs in its own process, with its output discarded but for one line
+// of results sent back over a pipe
+static int sweep_buffers(int frames) {
+    static const size_t counts[] = {2, 3, 4, 6, 8};
+    static const size_t lines[] = {20, 40, 60};
+    printf("direct mode over 40MHz SPI, %d frames per configuration\n", frames);
+    printf("  %-9s %-9s %10s %8s\n", "buffers", "lines", "ms/frame", "FPS");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        for (size_t l = 0; l < sizeof(lines) / sizeof(lines[0]); ++l) {
+            int fds[2];
+            if (0 != pipe(fds)) {
+                puts("Unable to create a pipe");
+                return 1;
+            }
+            fflush(stdout);
+            const pid_t pid = fork();
+            if (pid < 0) {
+                puts("Unable to fork");
+                return 1;
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                if (freopen("/dev/null", "w", stdout) == nullptr) {
+                    _exit(1);
+                }
+                // enough DMA heap that every configuration fits
+                sim::dma_heap(512 * 1024, 128 * 1024);
+                sim::spi_timing(true);
+                sim::virtual_clock(true);
+                panel_transfer_buffers_requested = counts[c];
+                panel_stripe_lines_requested = lines[l];
+                panel_direct = true;
+                app_main();
+                loop();
+                panel_flush_wait();
+                const uint64_t start_ts = now_us();
+                for (int i = 0; i < frames; ++i) {
+                    sim::advance_clock(1000 / 30);
+                    loop();
+                }
+                panel_flush_wait();
+                const double ms = (now_us() - start_ts) / 1000.0 / frames;
+                dprintf(fds[1], "  %-9zu %-9zu %10.3f %8.1f\n",
+                        panel_transfer_buffer_count,
+                        panel_transfer_buffer_size / (320 * 2),
+                        ms, 1000.0 / ms);
+                _exit(0);
+            }
+            close(fds[1]);
+            char line[256];
+            const ssize_t size = read(fds[0], line, sizeof(line) - 1);
+            close(fds[0]);
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (size <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                printf("  %zu buffers of %zu lines failed\n", counts[c], lines[l]);
+                continue;
+            }
+            line[size] = '\0';
+            fputs(line, stdout);
+        }
+    }
+    return 0;
+}
+int main(int argc, char** argv) {
+    int frames = 300;
+    const char* invalidate = "compare";
+    const char* render = panel_direct ? "direct" : "uix";
+    const char* ppm = "warhol.ppm";
+    const char* trace = nullptr;
+    int sprites = (int)warhol_box_t::default_sprites;
+    int sprite_size = warhol_box_t::default_sprite_size;
+    const char* seed = nullptr;
+    int target_fps = 0;
+    uint32_t seek_ms = 0;
+    bool sweep = false;
+    int budget_us = -1;
+    int scale = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--fps") && i + 1 < argc) {
+            fps = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--target-fps") && i + 1 < argc) {
+            target_fps = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--invalidate") && i + 1 < argc) {
+            invalidate = argv[++i];
+        } else if (0 == strcmp(argv[i], "--render") && i + 1 < argc) {
+            render = argv[++i];
+        } else if (0 == strcmp(argv[i], "--ppm") && i + 1 < argc) {
+            ppm = argv[++i];
+        } else if (0 == strcmp(argv[i], "--workers") && i + 1 < argc) {
+            panel_render_workers = (size_t)atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--depth") && i + 1 < argc) {
+            panel_pipeline_depth = (size_t)atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--sprites") && i + 1 < argc) {
+            sprites = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--sprite-size") && i + 1 < argc) {
+            sprite_size = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--collide")) {
+            panel_collisions = true;
+        } else if (0 == strcmp(argv[i], "--physics-budget") && i + 1 < argc) {
+            panel_physics_budget_us = (uint32_t)atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = argv[++i];
+        } else if (0 == strcmp(argv[i], "--seek") && i + 1 < argc) {
+            seek_ms = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (0 == strcmp(argv[i], "--scale") && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--interlace")) {
+            panel_interlace = true;
+        } else if (0 == strcmp(argv[i], "--budget") && i + 1 < argc) {
+            budget_us = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--pause-after") && i + 1 < argc) {
+            pause_after = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--no-preload")) {
+            panel_preload = false;
+        } else if (0 == strcmp(argv[i], "--spi")) {
+            sim::spi_timing(true);
+        } else if (0 == strcmp(argv[i], "--sweep-buffers")) {
+            sweep = true;
+        } else if (0 == strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (0 == strcmp(argv[i], "--partition") && i + 1 < argc) {
+#ifndef WARHOL_ASSET_PARTITION
+            puts("--partition needs a build with -DWARHOL_ASSET_PARTITION");
+            return 1;
+#endif
+            sim::partition_file(argv[++i]);
+        } else if (0 == strcmp(argv[i], "--export-asset") && i + 2 < argc) {
+            return sim::export_asset(argv[i + 1], argv[i + 2]);
+        } else if (0 == strcmp(argv[i], "--bench") && i + 1 < argc) {
+            return sim::bench(argv[i + 1]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (frames < 1 || fps < 0 || target_fps < 0 || (scale != 1 && scale != 2) || sprites < 1 || sprites > (int)sprite_bins::max_sprites || sprite_size < 1 ||
+        sprite_size > 119 ||
+        (0 != strcmp(invalidate, "full") && 0 != strcmp(invalidate, "dirty") &&
+         0 != strcmp(invalidate, "coalesced") && 0 != strcmp(invalidate, "compare")) ||
+        (0 != strcmp(render, "uix") && 0 != strcmp(render, "direct"))) {
+        usage(argv[0]);
+        return 1;
+    }
+    // pacing sleeps on the real clock, so it runs on wall time
+    if (target_fps > 0) {
+        fps = 0;
+    }
+    panel_target_fps = (uint32_t)target_fps;
+    // frame costs are real time, so the governor would make runs differ
+    // from one to the next. It's only on when asked for.
+    panel_governor_enabled = budget_us >= 0;
+    panel_frame_budget_us = budget_us > 0 ? (uint32_t)budget_us : 0;
+    if (sweep) {
+        return sweep_buffers(frames);
+    }
+    sim::virtual_clock(fps > 0);
+    // sleeping waits on wall time, which the virtual clock doesn't follow
+    panel_idle_sleep = fps == 0;
+    panel_direct = 0 == strcmp(render, "direct");
+    main_box.sprites((size_t)sprites);
+    main_box.sprite_size((int16_t)sprite_size);
+    main_box.render_scale((uint8_t)scale);
+    if (seed != nullptr) {
+        main_box.seed((uint32_t)strtoul(seed, nullptr, 0));
+    }
+    // the first frame waits for the background and prints the boot times
+    app_main();
+    loop();
+    if (seek_ms != 0) {
+        main_box.seek(seek_ms);
+    }
+    const bool compare = 0 == strcmp(invalidate, "compare");
+    if (compare || 0 == strcmp(invalidate, "full")) {
+        main_box.dirty_tracking(false);
+        run("full", frames);
+    }
+    if (compare || 0 == strcmp(invalidate, "dirty")) {
+        main_box.dirty_tracking(true);
+        main_box.coalesce(false);
+        run("dirty", frames);
+    }
+    if (compare || 0 == strcmp(invalidate, "coalesced")) {
+        main_box.dirty_tracking(true);
+        main_box.coalesce(true);
+        run("coalesced", frames);
+    }
+    panel_flush_wait();
+    printf("backgrounds: %u produced, %u consumed\n",
+           (unsigned)main_box.backgrounds_produced(),
+           (unsigned)main_box.backgrounds_consumed());
+    printf("animation: %ums in, seed %u\n", (unsigned)main_box.animation_ms(), (unsigned)main_box.seed());
+    if (panel_governor.budget_us() != 0) {
+        panel_governor.print();
+    }
+    if (!sim::write_ppm(ppm)) {
+        printf("Unable to write %s\n", ppm);
+        return 1;
+    }
+    printf("wrote %s\n", ppm);
+    if (trace != nullptr) {
+        FILE* file = fopen(trace, "w");
+        if (file == nullptr) {
+            printf("Unable to write %s\n", trace);
+            return 1;
+        }
+        panel_trace.dump(file);
+        fclose(file);
+        printf("wrote %s\n", trace);
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+// host simulator: the fake ILI9342 panel and its framebuffer
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "rgb565_asset.hpp"
+namespace sim {
+constexpr const int panel_width = 320;
+constexpr const int panel_height = 240;
+// traffic the fake panel has seen since the last reset
+struct panel_counters {
+    uint64_t windows;  // esp_lcd_panel_draw_bitmap calls (CASET+RASET+RAMWR each)
+    uint64_t pixels;   // pixels pushed
+    uint64_t bytes;    // bytes on the wire, commands and parameters included
+};
+// when enabled the tick count only moves on advance_clock(), so the
+// animation steps the same amount per frame however fast the host is
+void virtual_clock(bool enabled);
+void advance_clock(uint32_t ms);
+// when enabled, transfers take as long as they would at the panel's SPI
+// clock and complete on another thread, like the real DMA. Otherwise they
+// land and complete inside esp_lcd_panel_draw_bitmap.
+void spi_timing(bool enabled);
+// size of the pretend internal DMA heap MALLOC_CAP_DMA allocates from
+void dma_heap(size_t free_size, size_t largest_block);
+// backs the "warhol" data partition with a file (see WARHOL_ASSET_PARTITION)
+void partition_file(const char* path);
+// the panel GRAM as native-endian RGB565
+const uint16_t* framebuffer();
+panel_counters counters();
+void reset_counters();
+// dump the panel GRAM as a binary (P6) PPM
+bool write_ppm(const char* path);
+// decodes the embedded JPEG into a panel sized RGB565 buffer
+bool decode_jpeg(uint8_t* dst);
+size_t jpeg_asset_size();
+// packs panel sized RGB565 pixels as an asset, header included
+std::vector<uint8_t> make_asset(const uint8_t* pixels, rgb565_asset_format format);
+// writes the JPEG as a raw or lz4 asset header, or as the bare asset if
+// path ends in .bin, ready to flash to a partition. Returns an exit code.
+int export_asset(const char* format, const char* path);
+// runs the named micro-benchmark, or lists them. Returns an exit code.
+int bench(const char* name);
+}  // namespace sim
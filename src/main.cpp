@@ -3,9 +3,12 @@
 #include <Wire.h>
 #else
 #include <stdint.h>
+#include <stdio.h>
 #include <esp_idf_version.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
 uint32_t millis() { return pdTICKS_TO_MS(xTaskGetTickCount()); }
 void loop();
 #endif
@@ -15,15 +18,38 @@ void loop();
 #include <esp_lcd_panel_ops.h>
 #include <esp_lcd_panel_vendor.h>
 #include <esp_lcd_panel_ili9342.h>
+#include <atomic>
 #include <esp_i2c.hpp>
 #include <m5core2_power.hpp> // AXP192 power management (core2)
 #include <uix.hpp> // user interface library
 #include <gfx.hpp> // graphics library
+// the background: JPEG by default, or pre-decoded RGB565 written by the
+// simulator's --export-asset, so there's nothing to decode at startup
+#if defined(WARHOL_ASSET_LZ4)
+#define WARHOL320_LZ4_IMPLEMENTATION
+#include "assets/warhol320_lz4.h"
+#elif defined(WARHOL_ASSET_RAW)
+#define WARHOL320_RAW_IMPLEMENTATION
+#include "assets/warhol320_raw.h"
+#else
 #define WARHOL320_IMPLEMENTATION
 #include "assets/warhol320.h"
+#endif
+#include "rgb565_asset.hpp"
+#ifdef WARHOL_ASSET_PARTITION
+#include <esp_partition.h>
+#endif
 
 #include "ui.hpp" // ui declarations
 #include "panel.hpp" // display panel functionality
+#include "frame_stats.hpp" // per stage timings
+#include "trace.hpp" // pipeline trace events
+#include "boot_times.hpp" // startup phases
+#include "stripe_scheduler.hpp" // spreads stripes over the render workers
+#include "frame_pacer.hpp" // frame deadlines
+#include "animation_clock.hpp" // when the next frame is needed
+#include "quality_governor.hpp" // trades quality for frame time
+#include "flush_planner.hpp" // merges overlapping windows
 using namespace gfx; // graphics
 using namespace uix; // user interface
 #ifdef ARDUINO
@@ -36,21 +62,263 @@ using namespace esp_idf;
 // handle to the display
 static esp_lcd_panel_handle_t lcd_handle;
 // the transfer buffers
-uint8_t* panel_transfer_buffer1 = nullptr;
-uint8_t* panel_transfer_buffer2 = nullptr;
+#ifdef WARHOL_TRANSFER_BUFFERS
+size_t panel_transfer_buffers_requested = WARHOL_TRANSFER_BUFFERS;
+#else
+size_t panel_transfer_buffers_requested = 0;
+#endif
+#ifdef WARHOL_STRIPE_LINES
+size_t panel_stripe_lines_requested = WARHOL_STRIPE_LINES;
+#else
+size_t panel_stripe_lines_requested = 0;
+#endif
+size_t panel_transfer_buffer_count = 0;
+size_t panel_transfer_buffer_size = 0;
+uint8_t* panel_transfer_buffers[panel_max_transfer_buffers];
+#ifdef WARHOL_DIRECT
+bool panel_direct = true;
+#else
+bool panel_direct = false;
+#endif
+// a rendered stripe waiting for the flush task to send it
+struct panel_stripe {
+    uint8_t* buffer;
+    int16_t x1, y1, x2, y2;
+    uint8_t frame; // its panel_frames slot
+    uint8_t step; // 2 if it's every other row of y1 to y2, packed, or 1
+};
+// direct mode: buffers free to render into, and stripes ready to send
+static QueueHandle_t panel_free_buffers = nullptr;
+static QueueHandle_t panel_ready_stripes = nullptr;
+#ifdef WARHOL_RENDER_WORKERS
+size_t panel_render_workers = WARHOL_RENDER_WORKERS;
+#else
+size_t panel_render_workers = 2;
+#endif
+stripe_scheduler<panel_max_render_workers> panel_scheduler;
+// the stripes of the frame being rendered, in control coordinates. Every
+// changed rect is at most 240 lines, split at no less than the minimum.
+// Interlaced frames also cover the last frame's rects.
+constexpr const size_t panel_max_stripes = warhol_box_t::max_changed*2*(240/panel_min_stripe_lines+1);
+static srect16 panel_stripes[panel_max_stripes];
+#ifdef WARHOL_INTERLACE
+bool panel_interlace = true;
+#else
+bool panel_interlace = false;
+#endif
+// the rows the frame being rendered sends: 0 for the even ones, 1 for the
+// odd ones, or -1 for all of them
+static int8_t panel_field = -1;
+static bool panel_field_last = false; // the last frame was a field
+uint32_t panel_field_frames = 0;
+// the last frame's changed rects, which the other field hasn't seen yet
+static srect16 panel_field_rects[warhol_box_t::max_changed];
+static size_t panel_field_rects_size = 0;
+// merges them with the next frame's, which mostly overlap
+static flush_planner<warhol_box_t::max_changed*2> panel_field_planner;
+// the frame is only for that field, with nothing due on the clock
+static bool panel_field_only = false;
+// stripes still being rendered. The worker that finishes the last one
+// gives panel_frame_rendered.
+static std::atomic<uint32_t> panel_stripes_left(0);
+static SemaphoreHandle_t panel_frame_rendered = nullptr;
+static TaskHandle_t panel_render_tasks[panel_max_render_workers];
+#ifdef WARHOL_PIPELINE_DEPTH
+size_t panel_pipeline_depth = WARHOL_PIPELINE_DEPTH;
+#else
+size_t panel_pipeline_depth = 2;
+#endif
+// a direct mode frame between its snapshot and its last transfer
+struct panel_frame {
+    uint32_t snapshot_us;
+    std::atomic<uint32_t> transfers_left;
+};
+constexpr const uint8_t panel_no_frame = 0xFF;
+static panel_frame panel_frames[panel_max_pipeline_depth];
+static uint32_t panel_frame_count = 0;
+// one count per frame allowed in flight, given back by the flush-done
+// ISR when a frame's last transfer lands
+static SemaphoreHandle_t panel_frame_slots = nullptr;
+// what the render workers compose the current frame from
+static warhol_box_t::frame_state panel_frame_state;
+static uint8_t panel_frame_slot = 0;
+frame_stats panel_stats;
+trace_buffer panel_trace;
+boot_times panel_boot;
+// decode the background on the other core while the panel initializes
+#ifdef WARHOL_NO_PRELOAD
+bool panel_preload = false;
+#else
+bool panel_preload = true;
+#endif
+// frames per second loop() paces itself to, 0 for as fast as it can
+#ifdef WARHOL_TARGET_FPS
+uint32_t panel_target_fps = WARHOL_TARGET_FPS;
+#else
+uint32_t panel_target_fps = frame_pacer::default_fps;
+#endif
+frame_pacer panel_pacer;
+// loop() only renders when a control's tick is due, and sleeps otherwise
+animation_clock panel_clock;
+bool panel_idle_sleep = true;
+// how often an idle loop() still checks the console
+constexpr static const uint32_t panel_input_poll_ms = 100;
+// turns quality down when frames run over budget
+#ifdef WARHOL_NO_GOVERNOR
+bool panel_governor_enabled = false;
+#else
+bool panel_governor_enabled = true;
+#endif
+#ifdef WARHOL_FRAME_BUDGET_US
+uint32_t panel_frame_budget_us = WARHOL_FRAME_BUDGET_US;
+#else
+uint32_t panel_frame_budget_us = 0;
+#endif
+quality_governor panel_governor;
+// bars collide with each other, within the physics budget
+#ifdef WARHOL_COLLISIONS
+bool panel_collisions = true;
+#else
+bool panel_collisions = false;
+#endif
+#ifdef WARHOL_PHYSICS_BUDGET_US
+uint32_t panel_physics_budget_us = WARHOL_PHYSICS_BUDGET_US;
+#else
+uint32_t panel_physics_budget_us = sprite_physics::default_budget_us;
+#endif
+// the transfers still in flight, oldest first. They complete in order.
+// An interlaced stripe goes out a row at a time, so a buffer can have
+// several, and only the last one gives it back.
+struct panel_transfer {
+    const void* buffer; // to give back once done, or null if more follow
+    uint32_t start_us;
+    uint8_t frame; // panel_frames slot, or panel_no_frame
+};
+constexpr static const size_t panel_max_in_flight = panel_max_transfer_buffers*2;
+static panel_transfer panel_in_flight[panel_max_in_flight];
+static std::atomic<uint32_t> panel_flush_head(0);
+static std::atomic<uint32_t> panel_flush_tail(0);
+// completions with nothing in flight to pair them with
+static std::atomic<uint32_t> panel_flush_orphans(0);
+// queues a transfer of bmp to the panel and notes it until it's done
+static void panel_draw(int x1, int y1, int x2, int y2, const void* bmp, uint8_t frame, const void* buffer) {
+    panel_trace.begin(trace_buffer::flush);
+    const uint32_t head = panel_flush_head.load(std::memory_order_relaxed);
+    panel_transfer& transfer = panel_in_flight[head%panel_max_in_flight];
+    transfer.buffer = buffer;
+    transfer.start_us = frame_stats::now_us();
+    transfer.frame = frame;
+    panel_flush_head.store(head+1,std::memory_order_release);
+    panel_trace.begin(trace_buffer::dma,trace_buffer::dma_track);
+    esp_lcd_panel_draw_bitmap(lcd_handle, x1, y1, x2, y2, bmp);
+    panel_trace.end(trace_buffer::flush);
+}
+// the same, for a whole buffer
+static void panel_draw(int x1, int y1, int x2, int y2, const void* bmp, uint8_t frame) {
+    panel_draw(x1, y1, x2, y2, bmp, frame, bmp);
+}
 
 extern display disp;
 
 using power_t = m5core2_power;
 // for AXP192 power management
 static power_t power(esp_i2c<1,21,22>::instance);
+#if defined(WARHOL_ASSET_LZ4)
+bool warhol_load(uint8_t* dst, uint16_t width, uint16_t height) {
+    return rgb565_asset_load(warhol320_lz4,sizeof(warhol320_lz4),dst,width,height);
+}
+#elif defined(WARHOL_ASSET_RAW)
+bool warhol_load(uint8_t* dst, uint16_t width, uint16_t height) {
+    return rgb565_asset_load(warhol320_raw,sizeof(warhol320_raw),dst,width,height);
+}
+#else
 gfx::const_buffer_stream warhol_stm(warhol320,sizeof(warhol320));
+gfx::jpg_image warhol_img(warhol_stm);
+bool warhol_load(uint8_t* dst, uint16_t width, uint16_t height) {
+    gfx::bitmap<gfx::rgb_pixel<16>> bmp(gfx::size16(width,height),dst);
+    warhol_img.initialize();
+    gfx::size16 dim=warhol_img.dimensions();
+    gfx::draw::image(bmp,dim.bounds().center(bmp.bounds()),warhol_img);
+    return true;
+}
+#endif
+#ifdef WARHOL_ASSET_PARTITION
+// a raw asset written to the "warhol" data partition is mapped into the
+// address space and read in place, so swapping the image is a partition
+// write, not a rebuild. Anything else falls back to the embedded asset.
+const uint8_t* warhol_map(uint16_t width, uint16_t height) {
+    static const uint8_t* pixels = nullptr;
+    if(pixels!=nullptr) {
+        return pixels;
+    }
+    const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,ESP_PARTITION_SUBTYPE_ANY,"warhol");
+    if(part==nullptr) {
+        puts("No warhol partition, using the embedded background");
+        return nullptr;
+    }
+    const void* ptr;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_partition_mmap_handle_t handle;
+    if(ESP_OK!=esp_partition_mmap(part,0,part->size,ESP_PARTITION_MMAP_DATA,&ptr,&handle)) {
+#else
+    spi_flash_mmap_handle_t handle;
+    if(ESP_OK!=esp_partition_mmap(part,0,part->size,SPI_FLASH_MMAP_DATA,&ptr,&handle)) {
+#endif
+        puts("Unable to map the warhol partition, using the embedded background");
+        return nullptr;
+    }
+    rgb565_asset_info info;
+    if(!rgb565_asset_parse((const uint8_t*)ptr,part->size,&info) ||
+            info.format!=rgb565_asset_format::raw || info.width!=width || info.height!=height) {
+        esp_partition_munmap(handle);
+        puts("The warhol partition has no raw background, using the embedded one");
+        return nullptr;
+    }
+    // stays mapped for good
+    pixels = info.payload;
+    return pixels;
+}
+#else
+const uint8_t* warhol_map(uint16_t width, uint16_t height) {
+    return nullptr;
+}
+#endif
 
 
-// tell UIX the DMA transfer is complete
+// tell UIX (or the direct renderer) the DMA transfer is complete
 static bool panel_flush_ready(esp_lcd_panel_io_handle_t panel_io, 
                                 esp_lcd_panel_io_event_data_t* edata, 
                                 void* user_ctx) {
+    panel_trace.instant(trace_buffer::flush_ready,trace_buffer::dma_track);
+    panel_trace.end(trace_buffer::dma,trace_buffer::dma_track);
+    const uint32_t tail = panel_flush_tail.load(std::memory_order_relaxed);
+    if(tail==panel_flush_head.load(std::memory_order_acquire)) {
+        // there's no buffer to give back or frame to finish
+        panel_flush_orphans.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    const panel_transfer& transfer = panel_in_flight[tail%panel_max_in_flight];
+    const void* buffer = transfer.buffer;
+    const uint8_t frame = transfer.frame;
+    const bool last = buffer!=nullptr;
+    panel_stats.add(frame_stats::flush,transfer.start_us);
+    panel_flush_tail.store(tail+1,std::memory_order_release);
+    if(panel_direct) {
+        if(!last) {
+            // more rows of the same stripe to come
+            return false;
+        }
+        BaseType_t woken = pdFALSE;
+        if(frame!=panel_no_frame && 1==panel_frames[frame].transfers_left.fetch_sub(1,std::memory_order_acq_rel)) {
+            // the whole frame is on the panel
+            panel_stats.add(frame_stats::latency,panel_frames[frame].snapshot_us);
+            xSemaphoreGiveFromISR(panel_frame_slots,&woken);
+        }
+        // the buffer is free to render into again
+        BaseType_t buffer_woken = pdFALSE;
+        xQueueSendFromISR(panel_free_buffers,&buffer,&buffer_woken);
+        return woken==pdTRUE || buffer_woken==pdTRUE;
+    }
     disp.flush_complete();
     
     return true;
@@ -58,17 +326,131 @@ static bool panel_flush_ready(esp_lcd_panel_io_handle_t panel_io,
 // tell the lcd panel api to transfer data via DMA
 static void panel_on_flush(const rect16& bounds, const void* bmp, void* state) {
     int x1 = bounds.x1, y1 = bounds.y1, x2 = bounds.x2 + 1, y2 = bounds.y2 + 1;
-    esp_lcd_panel_draw_bitmap(lcd_handle, x1, y1, x2, y2, (void*)bmp);
+    panel_draw(x1, y1, x2, y2, bmp, panel_no_frame);
 }
 
+// sends the stripes the direct renderer queues, so rendering can run
+// up to panel_transfer_buffer_count stripes ahead of the panel
+static void panel_flush_task(void* arg) {
+    panel_stripe stripe;
+    while(1) {
+        xQueueReceive(panel_ready_stripes,&stripe,portMAX_DELAY);
+        if(stripe.step==1) {
+            panel_draw(stripe.x1,stripe.y1,stripe.x2+1,stripe.y2+1,stripe.buffer,stripe.frame);
+            continue;
+        }
+        // the panel can't skip rows, so each one is its own window
+        const size_t stride = (stripe.x2-stripe.x1+1)*2;
+        const uint8_t* row = stripe.buffer;
+        for(int y = stripe.y1;y<=stripe.y2;y+=stripe.step) {
+            panel_draw(stripe.x1,y,stripe.x2+1,y+1,row,stripe.frame,y+stripe.step>stripe.y2?stripe.buffer:nullptr);
+            row+=stride;
+        }
+    }
+}
+// renders the stripes worker claims from panel_scheduler until none are
+// left. Each goes to the flush task as soon as it's composed, into
+// whichever buffer the DMA finished with.
+static void panel_render_stripes(size_t worker) {
+    size_t index;
+    while(panel_scheduler.next(worker,&index)) {
+        const srect16& stripe = panel_stripes[index];
+        uint8_t* buffer;
+        uint32_t start_us = frame_stats::now_us();
+        panel_trace.begin(trace_buffer::flush_wait);
+        xQueueReceive(panel_free_buffers,&buffer,portMAX_DELAY);
+        panel_trace.end(trace_buffer::flush_wait);
+        panel_stats.add(frame_stats::flush_wait,start_us);
+        start_us = frame_stats::now_us();
+        panel_trace.begin(trace_buffer::paint);
+        uint8_t step = 1;
+        if(panel_field<0) {
+            main_box.render(panel_frame_state,buffer,stripe);
+        } else {
+            // just this field's rows, packed. The stripe starts and ends
+            // on one of them.
+            step = 2;
+            const size_t stride = stripe.width()*2;
+            uint8_t* row = buffer;
+            for(int16_t y = stripe.y1;y<=stripe.y2;y+=2) {
+                main_box.render(panel_frame_state,row,srect16(stripe.x1,y,stripe.x2,y));
+                row+=stride;
+            }
+        }
+        panel_trace.end(trace_buffer::paint);
+        panel_stats.add(frame_stats::paint,start_us);
+        const srect16 sr = stripe.offset(main_box.bounds().x1,main_box.bounds().y1);
+        const panel_stripe ready = {buffer,sr.x1,sr.y1,sr.x2,sr.y2,panel_frame_slot,step};
+        xQueueSend(panel_ready_stripes,&ready,portMAX_DELAY);
+        if(1==panel_stripes_left.fetch_sub(1,std::memory_order_acq_rel)) {
+            xSemaphoreGive(panel_frame_rendered);
+        }
+    }
+}
+// a render worker besides the loop task. It wakes for each frame and
+// helps until the frame's stripes are all claimed.
+static void panel_render_task(void* arg) {
+    const size_t worker = (size_t)arg;
+    while(1) {
+        ulTaskNotifyTake(pdTRUE,portMAX_DELAY);
+        panel_render_stripes(worker);
+    }
+}
+// picks the stripe height and buffer count from the free DMA heap and
+// allocates the ring
+static bool panel_alloc_buffers() {
+    const size_t line_size = 320*2;
+    size_t lines = panel_stripe_lines_requested?panel_stripe_lines_requested:panel_default_stripe_lines;
+    if(lines>240) {
+        lines = 240;
+    }
+    size_t count = panel_transfer_buffers_requested?panel_transfer_buffers_requested:panel_default_transfer_buffers;
+    if(count>panel_max_transfer_buffers) {
+        count = panel_max_transfer_buffers;
+    } else if(count<2) {
+        count = 2;
+    }
+    // shorten the stripes until at least two fit and leave the reserve
+    while(lines>panel_min_stripe_lines &&
+            (heap_caps_get_largest_free_block(MALLOC_CAP_DMA)<lines*line_size ||
+            heap_caps_get_free_size(MALLOC_CAP_DMA)<2*lines*line_size+panel_dma_reserve)) {
+        lines-=lines/4>0?lines/4:1;
+        if(lines<panel_min_stripe_lines) {
+            lines = panel_min_stripe_lines;
+        }
+    }
+    panel_transfer_buffer_size = lines*line_size;
+    panel_transfer_buffer_count = 0;
+    // then take as many as are wanted and fit
+    while(panel_transfer_buffer_count<count) {
+        if(panel_transfer_buffer_count>=2 &&
+                heap_caps_get_free_size(MALLOC_CAP_DMA)<panel_transfer_buffer_size+panel_dma_reserve) {
+            break;
+        }
+        uint8_t* buffer = (uint8_t*)heap_caps_malloc(panel_transfer_buffer_size,MALLOC_CAP_DMA);
+        if(buffer==nullptr) {
+            break;
+        }
+        panel_transfer_buffers[panel_transfer_buffer_count++]=buffer;
+    }
+    return panel_transfer_buffer_count>=2;
+}
 // initialize the screen using the esp panel API
 void panel_init() {
-    panel_transfer_buffer1 = (uint8_t*)heap_caps_malloc(panel_transfer_buffer_size,MALLOC_CAP_DMA);
-    panel_transfer_buffer2 = (uint8_t*)heap_caps_malloc(panel_transfer_buffer_size,MALLOC_CAP_DMA);
-    if(panel_transfer_buffer1==nullptr||panel_transfer_buffer2==nullptr) {
+    if(!panel_alloc_buffers()) {
         puts("Out of memory allocating transfer buffers");
         while(1) vTaskDelay(5);
     }
+    printf("Transfer buffers: %d x %d lines\n",(int)panel_transfer_buffer_count,(int)(panel_transfer_buffer_size/(320*2)));
+    panel_free_buffers = xQueueCreate(panel_transfer_buffer_count,sizeof(uint8_t*));
+    panel_ready_stripes = xQueueCreate(panel_transfer_buffer_count,sizeof(panel_stripe));
+    if(panel_free_buffers==nullptr||panel_ready_stripes==nullptr) {
+        puts("Out of memory allocating transfer queues");
+        while(1) vTaskDelay(5);
+    }
+    for(size_t i = 0;i<panel_transfer_buffer_count;++i) {
+        xQueueSend(panel_free_buffers,&panel_transfer_buffers[i],0);
+    }
     spi_bus_config_t buscfg;
     memset(&buscfg, 0, sizeof(buscfg));
     buscfg.sclk_io_num = 18;
@@ -90,7 +472,8 @@ void panel_init() {
     io_config.lcd_cmd_bits = 8,
     io_config.lcd_param_bits = 8,
     io_config.spi_mode = 0,
-    io_config.trans_queue_depth = 10,
+    // one color transaction per buffer in flight
+    io_config.trans_queue_depth = panel_transfer_buffer_count,
     io_config.on_color_trans_done = panel_flush_ready;
     // Attach the LCD to the SPI bus
     esp_lcd_new_panel_io_spi((esp_lcd_spi_bus_handle_t)SPI3_HOST, &io_config, &io_handle);
@@ -127,9 +510,197 @@ void panel_init() {
     esp_lcd_panel_disp_off(lcd_handle, true);
 #endif
     disp.buffer_size(panel_transfer_buffer_size);
-    disp.buffer1(panel_transfer_buffer1);
-    disp.buffer2(panel_transfer_buffer2);
+    disp.buffer1(panel_transfer_buffers[0]);
+    disp.buffer2(panel_transfer_buffers[1]);
     disp.on_flush_callback(panel_on_flush);
+    if(panel_direct) {
+        // above the loop task, so a stripe goes out as soon as it's ready
+        const BaseType_t core = xTaskGetCoreID(xTaskGetCurrentTaskHandle());
+        TaskHandle_t handle = nullptr;
+        xTaskCreatePinnedToCore(panel_flush_task,"panel_flush_task",2048,nullptr,25,&handle,core);
+        if(handle==nullptr) {
+            puts("Unable to start the flush task");
+            while(1) vTaskDelay(5);
+        }
+        if(panel_pipeline_depth<1) {
+            panel_pipeline_depth = 1;
+        } else if(panel_pipeline_depth>panel_max_pipeline_depth) {
+            panel_pipeline_depth = panel_max_pipeline_depth;
+        }
+        panel_frame_rendered = xSemaphoreCreateBinary();
+        panel_frame_slots = xSemaphoreCreateCounting(panel_pipeline_depth,panel_pipeline_depth);
+        if(panel_frame_rendered==nullptr || panel_frame_slots==nullptr) {
+            puts("Out of memory allocating the render semaphores");
+            while(1) vTaskDelay(5);
+        }
+        if(panel_render_workers<1) {
+            panel_render_workers = 1;
+        } else if(panel_render_workers>panel_max_render_workers) {
+            panel_render_workers = panel_max_render_workers;
+        }
+        // worker 0 is the loop task. The rest go on the other core, at
+        // the loop task's priority.
+        for(size_t i = 1;i<panel_render_workers;++i) {
+            panel_render_tasks[i] = nullptr;
+            xTaskCreatePinnedToCore(panel_render_task,"panel_render_task",4096,(void*)i,24,&panel_render_tasks[i],1-core);
+            if(panel_render_tasks[i]==nullptr) {
+                puts("Unable to start a render task");
+                while(1) vTaskDelay(5);
+            }
+        }
+        printf("Render workers: %d, pipeline depth: %d\n",(int)panel_render_workers,(int)panel_pipeline_depth);
+    }
+}
+#ifdef WARHOL_SIM
+void panel_flush_wait() {
+    if(panel_direct && panel_free_buffers!=nullptr) {
+        // stripes can still be queued for the flush task, not yet drawn
+        while(uxQueueMessagesWaiting(panel_free_buffers)<panel_transfer_buffer_count) {
+            vTaskDelay(1);
+        }
+    }
+    while(panel_flush_tail.load(std::memory_order_acquire)!=panel_flush_head.load(std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+}
+#endif
+// renders what changed straight into the DMA transfer buffers, bypassing
+// UIX. Each changed rect is split into stripes as tall as a buffer holds,
+// which the loop task and the render tasks share out between them. The
+// frame is composed from a snapshot, so the loop task moves the bars for
+// the next frame while the workers compose this one and the flush task
+// sends the last one: update, compose and flush all overlap, with at most
+// panel_pipeline_depth frames between their snapshot and the panel.
+static void panel_render_direct() {
+    uint32_t start_us = frame_stats::now_us();
+    panel_trace.begin(trace_buffer::flush_wait);
+    xSemaphoreTake(panel_frame_slots,portMAX_DELAY);
+    panel_trace.end(trace_buffer::flush_wait);
+    panel_stats.add(frame_stats::flush_wait,start_us);
+    main_box.on_before_paint();
+    if(!main_box.ready()) {
+        xSemaphoreGive(panel_frame_slots);
+        return;
+    }
+    srect16 rects[warhol_box_t::max_changed*2];
+    size_t rects_size = main_box.changed(rects);
+    if(panel_field_only) {
+        // nothing moved, so the bars changed() reports are already there
+        rects_size = 0;
+    }
+    // an interlaced frame only sends one field, so the other one still
+    // needs what changed in this frame, and the next frame needs what
+    // changed in both, whichever mode it goes out in
+    const size_t changed_size = rects_size;
+    if(panel_field_last && panel_field_rects_size!=0) {
+        panel_field_planner.clear();
+        for(size_t i = 0;i<changed_size;++i) {
+            panel_field_planner.add(rects[i]);
+        }
+        for(size_t i = 0;i<panel_field_rects_size;++i) {
+            panel_field_planner.add(panel_field_rects[i]);
+        }
+        panel_field_planner.plan();
+        // this frame's rects are kept for the next one first
+        for(size_t i = 0;i<changed_size;++i) {
+            panel_field_rects[i] = rects[i];
+        }
+        rects_size = panel_field_planner.size();
+        for(size_t i = 0;i<rects_size;++i) {
+            rects[i] = panel_field_planner[i];
+        }
+    } else {
+        for(size_t i = 0;i<changed_size;++i) {
+            panel_field_rects[i] = rects[i];
+        }
+    }
+    panel_field_rects_size = changed_size;
+    const srect16 bg_rect = main_box.background_bounds();
+    // a field sends half the rows, but each as its own window, and every
+    // window leaves the bus idle for its polled CASET/RASET/RAMWR. Only
+    // send one when that still costs less on the wire than the whole
+    // frame, which takes wide updates: bars moving over a still
+    // background go out whole.
+    const size_t window_cost = panel_field_planner.window_cost();
+    size_t whole_cost = 0, field_cost = 0;
+    for(size_t i = 0;i<rects_size;++i) {
+        if(rects[i].intersects(bg_rect)) {
+            const srect16 r = rects[i].crop(bg_rect);
+            const size_t row_bytes = r.width()*2;
+            const size_t lines = panel_transfer_buffer_size/row_bytes;
+            whole_cost+=row_bytes*r.height()+(r.height()+lines-1)/lines*window_cost;
+            field_cost+=(r.height()+1)/2*(row_bytes+window_cost);
+        }
+    }
+    panel_field = panel_interlace && field_cost<whole_cost?(int8_t)(panel_field_frames++&1):-1;
+    panel_field_last = panel_field>=0;
+    // half resolution works in 2x2 squares of the background
+    const bool half = main_box.render_scale()==2;
+    srect16 areas[warhol_box_t::max_changed*2];
+    size_t areas_size = 0;
+    size_t stripes_size = 0;
+    for(size_t i = 0;i<rects_size;++i) {
+        if(!rects[i].intersects(bg_rect)) {
+            continue;
+        }
+        srect16 r = rects[i].crop(bg_rect);
+        if(half) {
+            r = srect16(r.x1-((r.x1-bg_rect.x1)&1),r.y1-((r.y1-bg_rect.y1)&1),
+                        r.x2+(1-((r.x2-bg_rect.x1)&1)),r.y2+(1-((r.y2-bg_rect.y1)&1)));
+            areas[areas_size++] = r;
+        }
+        int16_t lines = (int16_t)(panel_transfer_buffer_size/(r.width()*2));
+        int16_t step = 1;
+        if(panel_field>=0) {
+            // a buffer holds lines rows of the field, spread over twice
+            // as many. Each stripe starts and ends on one of them.
+            step = 2;
+            r.y1+=(r.y1&1)!=panel_field;
+            r.y2-=(r.y2&1)!=panel_field;
+            if(r.y1>r.y2) {
+                continue;
+            }
+        } else if(half) {
+            lines&=~1;
+        }
+        for(int16_t y = r.y1;y<=r.y2 && stripes_size<panel_max_stripes;y+=lines*step) {
+            int16_t y2 = y+(lines-1)*step;
+            if(y2>r.y2) {
+                y2 = r.y2;
+            }
+            panel_stripes[stripes_size++] = srect16(r.x1,y,r.x2,y2);
+        }
+    }
+    if(stripes_size==0) {
+        xSemaphoreGive(panel_frame_slots);
+        main_box.on_after_paint();
+        return;
+    }
+    main_box.snapshot(&panel_frame_state);
+    if(half) {
+        // the half size scene is small enough to compose here, up front.
+        // The workers then only pixel double it into their stripes.
+        start_us = frame_stats::now_us();
+        for(size_t i = 0;i<areas_size;++i) {
+            main_box.compose(panel_frame_state,areas[i]);
+        }
+        panel_stats.add(frame_stats::paint,start_us);
+    }
+    panel_frame_slot = (uint8_t)(panel_frame_count++%panel_max_pipeline_depth);
+    panel_frame& frame = panel_frames[panel_frame_slot];
+    frame.snapshot_us = frame_stats::now_us();
+    frame.transfers_left.store((uint32_t)stripes_size,std::memory_order_relaxed);
+    panel_stripes_left.store((uint32_t)stripes_size,std::memory_order_relaxed);
+    panel_scheduler.start(stripes_size,panel_render_workers);
+    // a lone stripe isn't worth waking anyone for
+    for(size_t i = 1;i<panel_render_workers && i<stripes_size;++i) {
+        xTaskNotifyGive(panel_render_tasks[i]);
+    }
+    // the next frame's update runs while the workers compose this one
+    main_box.on_after_paint();
+    panel_render_stripes(0);
+    // the stripes and snapshot can't be reused until every worker is done
+    xSemaphoreTake(panel_frame_rendered,portMAX_DELAY);
 }
 // the screen/control definitions
 display disp;
@@ -140,52 +711,168 @@ void setup() {
     Serial.begin(115200);
     Serial.printf("Arduino version: %d.%d.%d\n",ESP_ARDUINO_VERSION_MAJOR,ESP_ARDUINO_VERSION_MINOR,ESP_ARDUINO_VERSION_PATCH);
 #else
+#ifndef WARHOL_SIM
 static void loop_task(void* arg) {
-    uint32_t time_ts = millis();
+    // loop() sleeps until each frame is due, or yields now and then when
+    // it's unpaced, so the idle task gets to run either way
     while(1) {
         loop();
-        if(millis()>time_ts+150) {
-            time_ts = millis();
-            vTaskDelay(1);
-        }
     }
 }
+#endif
 extern "C" void app_main() {
     printf("ESP-IDF version: %d.%d.%d\n",ESP_IDF_VERSION_MAJOR,ESP_IDF_VERSION_MINOR,ESP_IDF_VERSION_PATCH);
 #endif
+    panel_boot.mark(boot_times::app_start);
+    main_box.boot(&panel_boot);
+    if(panel_preload) {
+        main_box.preload();
+    }
     power.initialize(); // do this first
+    panel_boot.mark(boot_times::power);
     panel_init(); // do this next
+    panel_boot.mark(boot_times::panel);
     // init the screen and callbacks
     main_screen.dimensions({320,240});
     main_screen.background_color(color_t::black);
     main_box.bounds(main_screen.bounds());
+    // direct mode needs no full screen frames, so pick it before the box
+    // allocates
+    main_box.direct(panel_direct);
+    main_box.stats(&panel_stats);
+    panel_pacer.target_fps(panel_target_fps);
+    panel_pacer.stats(&panel_stats);
+    main_box.collisions(panel_collisions);
+    main_box.physics().budget_us(panel_physics_budget_us);
+    main_box.trace(&panel_trace);
+    main_box.clock(&panel_clock);
+    panel_governor.budget_us(!panel_governor_enabled?0:(panel_frame_budget_us!=0?panel_frame_budget_us:panel_pacer.period_us()));
     main_screen.register_control(main_box);
     disp.active_screen(main_screen);
-#ifndef ARDUINO
+#if !defined(ARDUINO) && !defined(WARHOL_SIM)
+    // the simulator drives loop() itself
     TaskHandle_t handle;
     xTaskCreatePinnedToCore(loop_task,"loop_task",4096,nullptr,24,&handle,xTaskGetCoreID(xTaskGetCurrentTaskHandle()));
 #endif
 }
 
-void loop()
-{
-    static int frames = 0;
-    static int time_ts = millis();
-    static long long total_ms = 0;
-    uint32_t start_ts = millis();
-    main_box.invalidate();
-    disp.update();
-    uint32_t end_ts = millis();
-    total_ms += (end_ts-start_ts);
-    ++frames;
+// a command byte from the serial console, or -1 if none is waiting
+static int panel_read_command() {
+#if defined(ARDUINO)
+    return Serial.available()?Serial.read():-1;
+#elif defined(WARHOL_SIM)
+    // the simulator dumps the trace itself
+    return -1;
+#else
+    // stdin on the console UART doesn't block when it's empty
+    const int result = getchar();
+    return result==EOF?-1:result;
+#endif
+}
+// sets the box up for the governor's current level
+static void panel_apply_quality() {
+    const quality_level& q = panel_governor.current();
+    const size_t active = main_box.sprites()*q.sprite_percent/100;
+    main_box.active_sprites(active<1?1:active);
+    main_box.blend_bits(q.blend_bits);
+    main_box.bg_stride(q.bg_stride);
+    main_box.render_scale(q.render_scale);
+}
+// true if a control needs a frame by the time the next one would start
+bool panel_frame_due() {
+    if(panel_clock.due(panel_pacer.period_us()/1000)) {
+        panel_field_only = false;
+        return true;
+    }
+    // the field that wasn't sent last frame is owed whether anything's
+    // moving or not
+    panel_field_only = panel_direct && panel_field_last && panel_field_rects_size!=0;
+    return panel_field_only;
+}
+// console commands and the once a second stats, rendering or not
+static void panel_service() {
+    static uint32_t time_ts = millis();
+    switch(panel_read_command()) {
+        // 't' dumps the most recent trace events as JSON
+        case 't':
+            panel_trace.dump(stdout);
+            panel_trace.clear();
+            break;
+        // 'p' pauses or resumes the animation
+        case 'p':
+            main_box.paused(!main_box.paused());
+            panel_clock.wake();
+            break;
+        // 'h' switches direct mode between full and half resolution
+        case 'h':
+            main_box.render_scale(main_box.render_scale()==2?1:2);
+            panel_clock.wake();
+            break;
+        // 'i' switches direct mode between progressive and interlaced
+        case 'i':
+            panel_interlace = !panel_interlace;
+            panel_clock.wake();
+            break;
+    }
     if(millis()>=time_ts+1000) {
-        if(frames==0) {
-            printf("<1 FPS, Total: %dms\n",(int)total_ms);
-        } else {
-            printf("%d FPS, Avg: %dms\n",frames,(int)(total_ms/frames));
+        printf("%d FPS\n",(int)panel_stats[frame_stats::frame].count());
+        panel_stats.print();
+        panel_stats.reset();
+        const uint32_t orphans = panel_flush_orphans.exchange(0,std::memory_order_relaxed);
+        if(orphans!=0) {
+            printf("flush: %u completions with nothing in flight\n",(unsigned)orphans);
+        }
+        if(main_box.collisions()) {
+            main_box.physics().print();
+        }
+        main_box.physics().reset_counters();
+        panel_pacer.print();
+        panel_pacer.reset_counters();
+        panel_clock.print();
+        panel_clock.reset_counters();
+        if(panel_governor.budget_us()!=0) {
+            panel_governor.print();
+            panel_governor.reset_counters();
         }
-        frames = 0;
-        total_ms = 0;
         time_ts = millis();
     }
 }
+void loop()
+{
+    if(!panel_frame_due()) {
+        // nothing moving: no frame, no SPI. Sleep until something is due
+        // or an input event wakes us, checking the console now and then.
+        panel_clock.note_idle();
+        if(panel_idle_sleep) {
+            panel_clock.sleep(panel_input_poll_ms);
+        }
+        // the frames slept through weren't missed
+        panel_pacer.resync();
+        panel_service();
+        return;
+    }
+    panel_pacer.wait();
+    if(panel_pacer.paced()) {
+        // animate to the next frame's deadline rather than whenever this
+        // one finishes, so the bars move evenly frame to frame
+        main_box.frame_time(panel_pacer.frame_time_ms());
+    }
+    const uint32_t start_us = frame_stats::now_us();
+    panel_trace.begin(trace_buffer::frame);
+    if(panel_direct) {
+        panel_render_direct();
+    } else {
+        main_box.invalidate_changed();
+        disp.update();
+    }
+    panel_trace.end(trace_buffer::frame);
+    panel_stats.add(frame_stats::frame,start_us);
+    if(panel_governor.add(frame_stats::now_us()-start_us)) {
+        panel_apply_quality();
+    }
+    if(!panel_boot.marked(boot_times::first_frame) && main_box.ready()) {
+        panel_boot.mark(boot_times::first_frame);
+        panel_boot.print();
+    }
+    panel_service();
+}